@@ -3,8 +3,8 @@
 /*
  * File: Library.cpp
  * Authors: Serif Nguyen & Jonathan Huntley
- * Version 0.6
- * Previous Version: 0.5
+ * Version 0.9
+ * Previous Version: 0.8
  * Date: December 15, 2025
  * 
  * Description:
@@ -13,24 +13,107 @@
  *  Includes seeding of initial books if the database is empty.
  * 
  * Usage:
- *  Compile the program using a C++17 compatible compiler.
+ *  Compile the program using a C++17 compatible compiler (with -pthread on Linux).
  * Run the executable and follow the on-screen menu prompts.
  * The library data is stored in "library.csv" in the same directory
  * as the executable.
+ * Tests are shell scripts in tests/ that build the program and drive it, for
+ * example "sh tests/concurrent_terminals.sh".
  * 
  * Example Commands:
  * - To add a book, select option 1 and provide the title and author.
  * - To list all books, select option 2.
- * - To check out a book, select option 3 and provide the book ID.
- * - To check in a book, select option 4 and provide the book ID.
+ * - To check out books, select option 3 and provide one or more book IDs.
+ * - To check in books, select option 4 and provide one or more book IDs.
  * - To delete a book, select option 5 and provide the book ID.
  * - To exit the program, select option 6.
+ * - To search titles and authors, select option 7 and enter one or more words.
+ * - To list one author's books, select option 8 and enter the author's name.
  * 
  * Execution:
  * ./Library
+ * ./Library add "The Hobbit" "J.R.R. Tolkien"
+ * ./Library list [--available | --checked-out]
+ * ./Library checkout 12 15 19      (also checkin and delete)
+ * ./Library search hobbit OR potter
+ * ./Library suggest tolk
+ * ./Library author "Rick Riordan" [--available]
+ * ./Library filter 'status=available AND author~"Gaiman" AND id>1000'
+ * ./Library check [--rejects bad-rows.txt]
+ *     Reads library.csv and reports rows that fail to parse; --rejects also
+ *     writes each of them, with its line number and error, to a file.
+ * ./Library --script commands.txt
+ *     Runs without the menu. A script holds one command per line in the same
+ *     form; the whole run loads and saves library.csv once.
+ * ./Library serve [socket] [--http <port>] [--background-save <ms>]
+ *     Keeps the catalog in memory and serves it on a Unix domain socket (default
+ *     library.sock) and, with --http, as JSON on http://127.0.0.1:<port>/books.
+ *     With --background-save, a forked child saves at most every <ms> while
+ *     the server keeps answering, instead of saving before each reply.
+ * ./Library standby [copy.csv]
+ *     Keeps a warm copy (default library-standby.csv) by replaying every change
+ *     logged to library.csv.log, and reports how far behind it is.
  * -----------------------
  * Change Log:
- * 
+ *
+ *  - 0.9 (October 16, 2026)
+ *
+ * - Added forEachBook() to stream records one at a time instead of loading them all.
+ * - Listings are now paginated; each page seeks through an ID -> offset index.
+ * - Listing rows are formatted into an OutputBuffer and written in large blocks.
+ * - serialize(string&) appends records into a reusable buffer; saves write in blocks.
+ * - Book::tryDeserialize() parses with from_chars and reports errors without throwing.
+ * - Bad rows are summarized once in a LoadReport instead of one cerr line each;
+ *   "Library check --rejects <file>" writes every one of them to a file.
+ * - Rows that fail to parse are kept as they were read and written back by
+ *   every rewrite, so saving never deletes them. A row repeating an earlier
+ *   row's ID is kept the same way instead of replacing that book.
+ * - Adding a book with a comma or line break in its title or author is refused
+ *   everywhere (menu, command line, wire protocol, HTTP 400), so it cannot
+ *   write extra fields or rows into library.csv.
+ * - Reads and writes take a shared/exclusive FileLock so several terminals can
+ *   safely share one library.csv; saves replace the file atomically.
+ * - "Library serve" keeps the catalog in memory and serves it over a Unix domain
+ *   socket; the menu becomes a thin client whenever a server is running.
+ * - On Linux the server runs an epoll event loop: requests can be pipelined and
+ *   each wake-up commits once and answers with a single write per connection.
+ * - Terminals and the server speak a length-prefixed binary protocol with
+ *   batched multi-operation frames (see CatalogClient).
+ * - "serve --http <port>" adds a keep-alive HTTP/1.1 JSON endpoint for kiosks.
+ * - Server requests run on a work-stealing ThreadPool; GET /stats shows per
+ *   worker queue depth and steal counts.
+ * - Catalog reads are lock-free: records live in an epoch-protected RecordTable
+ *   and removed records are freed by epoch-based reclamation.
+ * - The in-memory catalog is split into shards by book ID, each with its own
+ *   record table, writer lock and dirty flag.
+ * - Check-out and check-in only succeed from the opposite state (a CAS in the
+ *   server), so a copy that is already out cannot be checked out twice.
+ * - Command-line subcommands (add, list, checkout, checkin, delete) and a
+ *   --script mode that runs a whole file against one in-memory load. Read-only
+ *   subcommands read the file under a shared lock instead.
+ * - Several books can be checked out or in as one all-or-nothing batch from the
+ *   menu, the command line, the wire protocol and POST /books/checkout.
+ * - Every change is appended to library.csv.log; "Library standby" tails it
+ *   into a warm copy of the catalog and reports replication lag.
+ * - "serve --background-save <ms>" saves from a forked child, so large saves
+ *   no longer stall the server; each save reports its time and copy-on-write cost.
+ * - Search by title and author words (menu option 7, "Library search", GET
+ *   /books?q=) backed by an inverted index with compressed posting lists.
+ * - Title and author autocomplete ("Library suggest", GET /suggest?q=) from a
+ *   sorted prefix index kept current as books are added and deleted.
+ * - Searches that match nothing retry with close spellings ("tolkein" finds
+ *   Tolkien), using a trigram index and a bit-parallel edit distance; GET
+ *   /books?q=..&fuzzy=1 asks for this directly.
+ * - An author index ("Library author", GET /books?author=) lists one author's
+ *   books, or just those on the shelf. It is saved as library.csv.authors so
+ *   loads do not rebuild it while the file is unchanged.
+ * - Filter expressions ("Library filter", GET /books?filter=) over id, status,
+ *   title and author, evaluated a block of 4096 books at a time over a
+ *   column-wise copy of the catalog.
+ * - Sorted listings ("list --sort title|author|status", GET /books?sort=) compare
+ *   precomputed collation keys, sort large catalogs on every core, and keep
+ *   each order until the catalog changes.
+ *
  *  - 0.8 (December 15, 2025)
  *
  * - Revised the code to make the PolyMorphism and Inheritance Functions more Obvious.
@@ -63,11 +146,245 @@
 #include <vector>
 #include <algorithm>
 #include <fstream>   // for file output
-#include <sstream>
 #include <limits>
+#include <functional>
+#include <filesystem>
+#include <charconv>
+#include <chrono>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <deque>
+#include <condition_variable>
+#include <random>
+#include <string_view>
+#include <cstdio>
+#include <cerrno>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <array>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <csignal>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 using namespace std;
 
+/* ------------------------
+ * Output Buffer
+ * ------------------------
+ */
+// Collects formatted text in one large block and hands it to the OS with a few
+// write() calls, instead of flushing stdout after every row like endl does.
+// Nothing is written until the buffer fills up or flush() is called.
+class OutputBuffer {
+private:
+    vector<char> buffer;
+    size_t used = 0;
+    int fd;
+
+public:
+    explicit OutputBuffer(int fd = 1, size_t capacity = 1 << 16)
+        : buffer(capacity), fd(fd) {
+    }
+
+    ~OutputBuffer() { flush(); }
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void append(string_view text) {
+        if (text.size() > buffer.size() - used) {
+            flush();
+            if (text.size() > buffer.size()) {
+                writeAll(text.data(), text.size());
+                return;
+            }
+        }
+        copy(text.begin(), text.end(), buffer.begin() + used);
+        used += text.size();
+    }
+
+    void append(int value) {
+        char digits[16];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        append(string_view(digits, result.ptr - digits));
+    }
+
+    void flush() {
+        if (used == 0) return;
+        // Anything already queued through cout must reach the terminal first.
+        cout.flush();
+        fflush(stdout);
+        writeAll(buffer.data(), used);
+        used = 0;
+    }
+
+private:
+    void writeAll(const char* data, size_t size) {
+        while (size > 0) {
+#ifdef _WIN32
+            int written = _write(fd, data, static_cast<unsigned int>(size));
+#else
+            ssize_t written = ::write(fd, data, size);
+#endif
+            if (written <= 0) {
+                if (written < 0 && errno == EINTR) continue;
+                return;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+};
+
+
+/* ------------------------
+ * File Locking
+ * ------------------------
+ */
+// Advisory lock shared by every process that opens the same catalog. Readers take
+// it Shared, anything that modifies the file takes it Exclusive. The lock lives on
+// a separate "<file>.lock" file because saves replace the catalog file itself.
+// Locks are not reentrant: take one at the start of an operation and call the
+// unlocked helpers (loadBooks, saveBook, overwriteDatabase) while holding it.
+struct LockStats {
+    size_t acquisitions = 0;
+    size_t contended = 0;        // acquisitions that had to wait for another process
+    double totalWaitSeconds = 0.0;
+    double maxWaitSeconds = 0.0;
+};
+
+LockStats& lockStats() {
+    static LockStats stats;
+    return stats;
+}
+
+class FileLock {
+public:
+    enum Mode { Shared, Exclusive };
+
+private:
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+
+public:
+    FileLock(const string& filename, Mode mode) {
+        const string lockName = filename + ".lock";
+        auto started = chrono::steady_clock::now();
+        bool waited = false;
+
+#ifdef _WIN32
+        handle = CreateFileA(lockName.c_str(), GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            cerr << "\nWarning: Could not open " << lockName << "; continuing without a lock." << endl;
+            return;
+        }
+        DWORD flags = (mode == Exclusive) ? LOCKFILE_EXCLUSIVE_LOCK : 0;
+        OVERLAPPED overlapped = {};
+        if (!LockFileEx(handle, flags | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped)) {
+            waited = true;
+            cout << "\nWaiting for another terminal to finish with " << filename << "..." << endl;
+            LockFileEx(handle, flags, 0, 1, 0, &overlapped);
+        }
+#else
+        fd = open(lockName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            cerr << "\nWarning: Could not open " << lockName << "; continuing without a lock." << endl;
+            return;
+        }
+        int operation = (mode == Exclusive) ? LOCK_EX : LOCK_SH;
+        if (flock(fd, operation | LOCK_NB) != 0) {
+            waited = true;
+            cout << "\nWaiting for another terminal to finish with " << filename << "..." << endl;
+            while (flock(fd, operation) != 0 && errno == EINTR) {
+            }
+        }
+#endif
+
+        double waitSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        LockStats& stats = lockStats();
+        stats.acquisitions++;
+        if (waited) stats.contended++;
+        stats.totalWaitSeconds += waitSeconds;
+        stats.maxWaitSeconds = max(stats.maxWaitSeconds, waitSeconds);
+    }
+
+    ~FileLock() {
+#ifdef _WIN32
+        if (handle != INVALID_HANDLE_VALUE) {
+            OVERLAPPED overlapped = {};
+            UnlockFileEx(handle, 0, 1, 0, &overlapped);
+            CloseHandle(handle);
+        }
+#else
+        if (fd >= 0) close(fd); // closing the descriptor releases the flock
+#endif
+    }
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+};
+
+void printLockStats(ostream& out = cout) {
+    const LockStats& stats = lockStats();
+    out << "\nFile locks: " << stats.acquisitions << " acquired, " << stats.contended
+        << " waited, " << stats.totalWaitSeconds << "s total wait, "
+        << stats.maxWaitSeconds << "s longest wait." << endl;
+}
+
+/* ------------------------
+ * Parse Errors
+ * ------------------------
+ */
+enum class ParseError {
+    None,
+    FieldCount, // not exactly four comma separated fields
+    BadId,      // ID is not a positive whole number that fits in an int
+    BadStatus,  // status is neither "Yes" nor "No"
+    DuplicateId // an earlier row already has this ID
+};
+
+const size_t PARSE_ERROR_KINDS = 5;
+
+const char* describeParseError(ParseError error) {
+    switch (error) {
+    case ParseError::None: return "OK";
+    case ParseError::FieldCount: return "Invalid book data format.";
+    case ParseError::BadId: return "Invalid book ID.";
+    case ParseError::BadStatus: return "Invalid checkout status.";
+    case ParseError::DuplicateId: return "Book ID already used by an earlier row.";
+    }
+    return "Unknown error.";
+}
 
 /* ------------------------
  * Base Class: LibraryItem
@@ -92,16 +409,50 @@ public:
     string getAuthor() const { return author; }
     bool getCheckedOut() const { return isCheckedOut; }
 
-    void checkOut() { isCheckedOut = true; }
-    void checkIn() { isCheckedOut = false; }
+    // Each succeeds only from the opposite state, so a copy that is already out
+    // cannot be checked out a second time.
+    bool checkOut() {
+        if (isCheckedOut) return false;
+        isCheckedOut = true;
+        return true;
+    }
+
+    bool checkIn() {
+        if (!isCheckedOut) return false;
+        isCheckedOut = false;
+        return true;
+    }
+
+    // Appends the CSV form of a row to out, which only needs
+    // append(const char*, size_t); the background saver passes a writer that
+    // never allocates.
+    template <typename Out>
+    static void serializeRow(Out& out, int id, string_view title, string_view author, bool checkedOut) {
+        char digits[16];
+        auto result = to_chars(digits, digits + sizeof(digits), id);
+        out.append(digits, static_cast<size_t>(result.ptr - digits));
+        out.append(", ", 2);
+        out.append(title.data(), title.size());
+        out.append(", ", 2);
+        out.append(author.data(), author.size());
+        if (checkedOut) out.append(", Yes", 5);
+        else out.append(", No", 4);
+    }
+
+    // Appends the CSV form of this item to out without allocating, as long as the
+    // caller reuses a buffer that already has room for it.
+    virtual void serialize(string& out) const {
+        serializeRow(out, id, title, author, isCheckedOut);
+    }
 
-    virtual string serialize() const {
-        ostringstream oss;
-        oss << id << ", " << title << ", " << author << ", " << (isCheckedOut ? "Yes" : "No");
-        return oss.str();
+    string serialize() const {
+        string out;
+        serialize(out);
+        return out;
     }
 
     virtual void print() const = 0;
+    virtual void print(OutputBuffer& out) const = 0;
 };
 
 /* ------------------------
@@ -119,60 +470,530 @@ public:
             << " | Title: " << title
             << " | Author: " << author
             << " | Status: " << (isCheckedOut ? "Checked Out" : "Available")
-            << endl;
+            << '\n';
     }
 
-    static Book deserialize(const string& line) {
-        istringstream iss(line);
-        string token;
-        vector<string> parts;
+    // Listing row, formatted straight into the caller's buffer.
+    void print(OutputBuffer& out) const override {
+        out.append("ID: ");
+        out.append(id);
+        out.append(" | Title: ");
+        out.append(title);
+        out.append(" | Author: ");
+        out.append(author);
+        out.append(" | Status: ");
+        out.append(isCheckedOut ? "Checked Out\n" : "Available\n");
+    }
 
-        while (getline(iss, token, ',')) {
-            size_t start = token.find_first_not_of(" \t");
-            size_t end = token.find_last_not_of(" \t");
-            if (start == string::npos || end == string::npos) parts.push_back("");
-            else parts.push_back(token.substr(start, end - start + 1));
+    // Parses one CSV line into out, reusing its string storage. Nothing throws: a
+    // malformed line is reported through the returned ParseError and out is left
+    // in an unspecified state.
+    static ParseError tryDeserialize(string_view line, Book& out) {
+        string_view parts[4];
+        size_t count = 0;
+
+        while (true) {
+            size_t comma = line.find(',');
+            string_view token = line.substr(0, comma);
+            size_t start = token.find_first_not_of(" \t\r");
+            size_t end = token.find_last_not_of(" \t\r");
+            if (count == 4) return ParseError::FieldCount;
+            parts[count++] = (start == string_view::npos) ? string_view() : token.substr(start, end - start + 1);
+            if (comma == string_view::npos) break;
+            line.remove_prefix(comma + 1);
         }
+        if (count != 4) return ParseError::FieldCount;
+
+        const char* first = parts[0].data();
+        const char* last = first + parts[0].size();
+        auto result = from_chars(first, last, out.id);
+        if (parts[0].empty() || result.ec != errc() || result.ptr != last || out.id <= 0) return ParseError::BadId;
+
+        if (parts[3] == "Yes") out.isCheckedOut = true;
+        else if (parts[3] == "No") out.isCheckedOut = false;
+        else return ParseError::BadStatus;
+
+        out.title.assign(parts[1]);
+        out.author.assign(parts[2]);
+        return ParseError::None;
+    }
 
-        if (parts.size() != 4) throw runtime_error("Invalid book data format.");
-        int id = stoi(parts[0]);
-        string title = parts[1];
-        string author = parts[2];
-        bool isCheckedOut = (parts[3] == "Yes");
-        return Book(id, title, author, isCheckedOut);
+    static Book deserialize(const string& line) {
+        Book b(0, "", "");
+        ParseError error = tryDeserialize(line, b);
+        if (error != ParseError::None) throw runtime_error(describeParseError(error));
+        return b;
     }
 };
 
+/* ------------------------
+ * Load Report
+ * ------------------------
+ */
+// Summary of one pass over the catalog file. Rejected rows are counted by error
+// class and only the first few are kept, so a badly damaged file costs one short
+// report instead of a line of output per bad row.
+struct LoadReport {
+    struct Reject {
+        size_t lineNumber;
+        streamoff byteOffset;
+        ParseError error;
+    };
+
+    string filename;
+    size_t linesRead = 0;
+    size_t booksLoaded = 0;
+    size_t errorCounts[PARSE_ERROR_KINDS] = {};
+    vector<Reject> firstRejects;
+    double parseSeconds = 0.0;
+
+    size_t rejected() const { return linesRead - booksLoaded; }
+};
+
+struct LoadOptions {
+    size_t maxRejectSamples = 10;
+    string rejectsFile;                 // when set, every rejected line is also written here
+    vector<string>* keptRejects = nullptr; // when set, rejected lines are kept here as read
+    function<bool(int)> idTaken;        // when set, rows with an ID it reports taken are rejected
+};
+
+void printLoadReport(const LoadReport& report, ostream& out = cerr) {
+    out << "\nLoaded " << report.booksLoaded << " of " << report.linesRead << " rows from "
+        << report.filename << " in " << report.parseSeconds << "s";
+    if (report.rejected() == 0) {
+        out << "." << endl;
+        return;
+    }
+    out << ", " << report.rejected() << " rejected:\n";
+    for (size_t i = 1; i < PARSE_ERROR_KINDS; i++) {
+        if (report.errorCounts[i] == 0) continue;
+        out << "  " << describeParseError(static_cast<ParseError>(i)) << " x" << report.errorCounts[i] << "\n";
+    }
+    for (const auto& r : report.firstRejects) {
+        out << "  line " << r.lineNumber << " (byte " << r.byteOffset << "): "
+            << describeParseError(r.error) << "\n";
+    }
+    if (report.rejected() > report.firstRejects.size()) {
+        out << "  ... " << report.rejected() - report.firstRejects.size() << " more" << "\n";
+    }
+    out.flush();
+}
+
 /* ------------------------
  * File Operations
  * ------------------------
  */
-vector<Book> loadBooks(const string& filename) {
-    vector<Book> books;
-    ifstream infile(filename);
+// Streams the catalog one record at a time. The callback returns false to stop early,
+// so only a single Book is held in memory no matter how large the file is.
+LoadReport forEachBook(const string& filename, const function<bool(const Book&)>& callback,
+    const LoadOptions& options = LoadOptions()) {
+    auto started = chrono::steady_clock::now();
+    LoadReport report;
+    report.filename = filename;
+
+    ifstream infile(filename, ios::binary);
+    ofstream rejects;
+    if (!options.rejectsFile.empty()) rejects.open(options.rejectsFile, ios::trunc);
+
     string line;
+    Book book(0, "", "");
+    streamoff offset = 0;
 
     while (getline(infile, line)) {
-        try {
-            books.push_back(Book::deserialize(line));
-        }
-        catch (...) {
-            cerr << "ID: N/A " << line << endl;
+        streamoff lineStart = offset;
+        offset += static_cast<streamoff>(line.size()) + 1;
+        report.linesRead++;
+
+        ParseError error = Book::tryDeserialize(line, book);
+        if (error == ParseError::None && options.idTaken && options.idTaken(book.getId())) error = ParseError::DuplicateId;
+        if (error != ParseError::None) {
+            report.errorCounts[static_cast<size_t>(error)]++;
+            if (report.firstRejects.size() < options.maxRejectSamples) {
+                report.firstRejects.push_back({ report.linesRead, lineStart, error });
+            }
+            if (rejects) {
+                rejects << report.linesRead << ", " << lineStart << ", "
+                    << describeParseError(error) << ", " << line << '\n';
+            }
+            if (options.keptRejects && line.find_first_not_of(" \t\r") != string::npos) {
+                options.keptRejects->push_back(line);
+            }
+            continue;
         }
+
+        report.booksLoaded++;
+        if (!callback(book)) break;
     }
+
+    report.parseSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    return report;
+}
+
+// Loads the whole catalog, printing the load report if any rows were rejected.
+// A row repeating an earlier row's ID is rejected too. Callers that are going to
+// rewrite the file pass rejectedLines and hand them back to overwriteDatabase.
+// Callers hold a FileLock for as long as they rely on the result.
+vector<Book> loadBooks(const string& filename, vector<string>* rejectedLines = nullptr) {
+    vector<Book> books;
+    unordered_set<int> seen;
+    LoadOptions options;
+    options.keptRejects = rejectedLines;
+    options.idTaken = [&](int id) { return !seen.insert(id).second; };
+    LoadReport report = forEachBook(filename, [&](const Book& b) {
+        books.push_back(b);
+        return true;
+    }, options);
+    if (report.rejected() > 0) printLoadReport(report);
     return books;
 }
 
+// "Library check": reads the whole file, prints the load report and, given a
+// rejectsFile, writes every rejected row to it as
+//     line number, byte offset, error, row
+// so damaged rows can be found and fixed by hand. Returns true if no row was
+// rejected.
+bool checkCatalogFile(const string& filename, const string& rejectsFile) {
+    FileLock lock(filename, FileLock::Shared);
+    unordered_set<int> seen;
+    LoadOptions options;
+    options.rejectsFile = rejectsFile;
+    options.idTaken = [&](int id) { return !seen.insert(id).second; };
+    LoadReport report = forEachBook(filename, [](const Book&) { return true; }, options);
+    printLoadReport(report, cout);
+    if (!rejectsFile.empty()) {
+        cout << "Wrote " << report.rejected() << " rejected rows to " << rejectsFile << "." << endl;
+    }
+    return report.rejected() == 0;
+}
+
 void saveBook(const string& filename, const Book& book) {
     ofstream outfile(filename, ios::app);
-    outfile << book.serialize() << endl;
+    string record;
+    book.serialize(record);
+    record += '\n';
+    outfile.write(record.data(), static_cast<streamsize>(record.size()));
 }
 
-void overwriteDatabase(const string& filename, const vector<Book>& books) {
-    ofstream outfile(filename, ios::trunc);
+// Records are serialized back to back into one reusable buffer, which is written
+// out whenever it passes SAVE_BLOCK_SIZE bytes.
+const size_t SAVE_BLOCK_SIZE = 1 << 20;
+
+// The new contents go to "<file>.tmp" first and are then renamed over the
+// catalog, so a reader never sees a half-written file. Rows the parser rejected
+// are written back after the books exactly as they were read: a row this
+// version cannot parse may still be one a person wants to fix, so a rewrite
+// must not be what deletes it.
+bool overwriteDatabase(const string& filename, const vector<Book>& books,
+    const vector<string>& rejectedLines = {}) {
+    const string tempName = filename + ".tmp";
+    ofstream outfile(tempName, ios::trunc);
+    if (!outfile) {
+        cerr << "\nError: Could not open " << tempName << " for writing." << endl;
+        return false;
+    }
+    string block;
+    block.reserve(SAVE_BLOCK_SIZE + 4096);
+
     for (const auto& b : books) {
-        outfile << b.serialize() << endl;
+        b.serialize(block);
+        block += '\n';
+        if (block.size() >= SAVE_BLOCK_SIZE) {
+            outfile.write(block.data(), static_cast<streamsize>(block.size()));
+            block.clear();
+        }
+    }
+    for (const auto& line : rejectedLines) {
+        block += line;
+        block += '\n';
+    }
+    outfile.write(block.data(), static_cast<streamsize>(block.size()));
+    outfile.close();
+    if (!outfile) {
+        cerr << "\nError: Could not write " << tempName << "." << endl;
+        return false;
+    }
+
+    error_code ec;
+    filesystem::rename(tempName, filename, ec);
+    if (ec) {
+        cerr << "\nError: Could not replace " << filename << ": " << ec.message() << endl;
+        return false;
+    }
+    return true;
+}
+
+/* ------------------------
+ * Offset Index
+ * ------------------------
+ */
+// Maps each book ID to the byte offset of its line so a page of results can seek
+// straight to the first row after the cursor instead of scanning from the top.
+// The index is cached and only rebuilt when the file's size or timestamp changes.
+struct OffsetIndex {
+    string filename;
+    uintmax_t fileSize = 0;
+    filesystem::file_time_type modified;
+    vector<pair<int, streamoff>> entries; // sorted by book ID
+};
+
+const OffsetIndex& getOffsetIndex(const string& filename) {
+    static OffsetIndex index;
+
+    error_code ec;
+    uintmax_t size = filesystem::file_size(filename, ec);
+    if (ec) size = 0;
+    filesystem::file_time_type modified = filesystem::last_write_time(filename, ec);
+
+    if (index.filename == filename && index.fileSize == size && index.modified == modified) {
+        return index;
+    }
+
+    index.filename = filename;
+    index.fileSize = size;
+    index.modified = modified;
+    index.entries.clear();
+
+    ifstream infile(filename, ios::binary);
+    string line;
+    Book book(0, "", "");
+    streamoff offset = 0;
+    while (getline(infile, line)) {
+        streamoff lineStart = offset;
+        offset += static_cast<streamoff>(line.size()) + 1;
+        // Bad rows are reported by the load report; they are simply not indexed here.
+        if (Book::tryDeserialize(line, book) == ParseError::None) {
+            index.entries.emplace_back(book.getId(), lineStart);
+        }
+    }
+    sort(index.entries.begin(), index.entries.end());
+    return index;
+}
+
+/* ------------------------
+ * Author Index
+ * ------------------------
+ */
+// Size and modification time of a catalog file, which tell whether an index
+// saved next to it still describes it.
+struct FileStamp {
+    uintmax_t size = 0;
+    int64_t modified = 0;
+
+    bool operator==(const FileStamp& other) const {
+        return size == other.size && modified == other.modified;
+    }
+};
+
+FileStamp fileStamp(const string& filename) {
+    FileStamp stamp;
+    error_code ec;
+    stamp.size = filesystem::file_size(filename, ec);
+    if (ec) return FileStamp();
+    stamp.modified = static_cast<int64_t>(filesystem::last_write_time(filename, ec).time_since_epoch().count());
+    return stamp;
+}
+
+// Authors are matched ignoring case and extra spaces, so "rick  riordan" finds
+// Rick Riordan.
+string authorKey(string_view author) {
+    string key;
+    for (char c : author) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (isspace(u)) {
+            if (!key.empty() && key.back() != ' ') key += ' ';
+        }
+        else {
+            key += static_cast<char>(tolower(u));
+        }
+    }
+    if (!key.empty() && key.back() == ' ') key.pop_back();
+    return key;
+}
+
+string authorIndexName(const string& filename) {
+    return filename + ".authors";
+}
+
+// The shared indexes split their contents over this many stripes by a hash of
+// the key, each with its own lock, so books added or deleted on different
+// catalog shards rarely wait for one another.
+const size_t INDEX_STRIPES = 16;
+
+size_t stripeOf(string_view key) {
+    return hash<string_view>{}(key) % INDEX_STRIPES;
+}
+
+// Maps each author to the IDs of their books, in ascending order. It is saved
+// next to the catalog as "<file>.authors", stamped with the size and time of
+// the file it describes, so a later load can take it as it is instead of
+// rebuilding it:
+//     authors 1 <TAB> file size <TAB> file time
+//     author key <TAB> id id id ...
+class AuthorIndex {
+private:
+    struct Stripe {
+        unordered_map<string, vector<int>> books;
+        mutable shared_mutex lock;
+    };
+
+    array<Stripe, INDEX_STRIPES> stripes;
+
+public:
+    void add(int id, string_view author) {
+        string key = authorKey(author);
+        Stripe& stripe = stripes[stripeOf(key)];
+        unique_lock<shared_mutex> guard(stripe.lock);
+        vector<int>& ids = stripe.books[key];
+        if (ids.empty() || ids.back() < id) ids.push_back(id);
+        else {
+            auto at = lower_bound(ids.begin(), ids.end(), id);
+            if (at == ids.end() || *at != id) ids.insert(at, id);
+        }
+    }
+
+    void remove(int id, string_view author) {
+        string key = authorKey(author);
+        Stripe& stripe = stripes[stripeOf(key)];
+        unique_lock<shared_mutex> guard(stripe.lock);
+        auto it = stripe.books.find(key);
+        if (it == stripe.books.end()) return;
+        vector<int>& ids = it->second;
+        auto at = lower_bound(ids.begin(), ids.end(), id);
+        if (at != ids.end() && *at == id) ids.erase(at);
+        if (ids.empty()) stripe.books.erase(it);
     }
+
+    // IDs of the author's books, ascending.
+    vector<int> find(string_view author) const {
+        string key = authorKey(author);
+        const Stripe& stripe = stripes[stripeOf(key)];
+        shared_lock<shared_mutex> guard(stripe.lock);
+        auto it = stripe.books.find(key);
+        return it == stripe.books.end() ? vector<int>() : it->second;
+    }
+
+    size_t authorCount() const {
+        size_t total = 0;
+        for (const auto& stripe : stripes) {
+            shared_lock<shared_mutex> guard(stripe.lock);
+            total += stripe.books.size();
+        }
+        return total;
+    }
+
+    // Replaces the contents with a saved index, if it was saved for exactly
+    // this stamp. Returns false, leaving the index empty, otherwise.
+    bool load(const string& path, const FileStamp& stamp) {
+        vector<unique_lock<shared_mutex>> guards;
+        for (auto& stripe : stripes) guards.emplace_back(stripe.lock);
+        auto clear = [this] {
+            for (auto& stripe : stripes) stripe.books.clear();
+        };
+        clear();
+        ifstream in(path, ios::binary);
+        string line;
+        if (!in || !getline(in, line)) return false;
+        if (line != "authors 1\t" + to_string(stamp.size) + "\t" + to_string(stamp.modified)) return false;
+
+        while (getline(in, line)) {
+            size_t tab = line.find('\t');
+            if (tab == string::npos) {
+                clear();
+                return false;
+            }
+            string_view key(line.data(), tab);
+            vector<int>& ids = stripes[stripeOf(key)].books[string(key)];
+            const char* p = line.data() + tab + 1;
+            const char* end = line.data() + line.size();
+            while (p < end) {
+                int id = 0;
+                auto result = from_chars(p, end, id);
+                if (result.ec != errc() || id <= 0 || (!ids.empty() && id <= ids.back())) {
+                    clear();
+                    return false;
+                }
+                ids.push_back(id);
+                p = result.ptr;
+                if (p < end && *p == ' ') p++;
+            }
+        }
+        return true;
+    }
+
+    // Writes the index for a file with the given stamp. Readers holding only a
+    // Shared FileLock may save at the same time, so each writes its own
+    // temporary file before renaming it into place.
+    bool save(const string& path, const FileStamp& stamp) const {
+        string out = "authors 1\t" + to_string(stamp.size) + "\t" + to_string(stamp.modified) + "\n";
+        char digits[16];
+        for (const auto& stripe : stripes) {
+            shared_lock<shared_mutex> guard(stripe.lock);
+            for (const auto& entry : stripe.books) {
+                out += entry.first;
+                out += '\t';
+                for (size_t i = 0; i < entry.second.size(); i++) {
+                    if (i > 0) out += ' ';
+                    out.append(digits, to_chars(digits, digits + sizeof(digits), entry.second[i]).ptr - digits);
+                }
+                out += '\n';
+            }
+        }
+
+        const string tempName = path + "." + to_string(random_device{}()) + ".tmp";
+        ofstream file(tempName, ios::binary | ios::trunc);
+        file.write(out.data(), static_cast<streamsize>(out.size()));
+        file.close();
+        error_code ec;
+        if (file) filesystem::rename(tempName, path, ec);
+        if (!file || ec) {
+            filesystem::remove(tempName, ec);
+            return false;
+        }
+        return true;
+    }
+};
+
+// Saves the author index for books, which the caller has just written to the
+// catalog file and still holds the FileLock on.
+void writeAuthorIndex(const string& filename, const vector<Book>& books) {
+    AuthorIndex index;
+    for (const auto& b : books) index.add(b.getId(), b.getAuthor());
+    index.save(authorIndexName(filename), fileStamp(filename));
+}
+
+// Carries the saved author index over the append of one book: if it described
+// the file before the append, it is updated and stamped for the file after it.
+// Otherwise it is left for the next lookup to rebuild.
+void addToAuthorIndex(const string& filename, const FileStamp& before, int id, const string& author) {
+    AuthorIndex index;
+    if (!index.load(authorIndexName(filename), before)) return;
+    index.add(id, author);
+    index.save(authorIndexName(filename), fileStamp(filename));
+}
+
+// The author index of a catalog file, for file mode. Like the offset index it is
+// cached until the file changes; after that the saved copy is used if it still
+// matches the file, and otherwise the index is rebuilt and saved again.
+// Callers hold a FileLock.
+const AuthorIndex& getAuthorIndex(const string& filename) {
+    static string cachedFile;
+    static FileStamp cachedStamp;
+    static unique_ptr<AuthorIndex> index;
+
+    FileStamp stamp = fileStamp(filename);
+    if (index && cachedFile == filename && cachedStamp == stamp) return *index;
+
+    index = make_unique<AuthorIndex>();
+    if (!index->load(authorIndexName(filename), stamp)) {
+        forEachBook(filename, [&](const Book& b) {
+            index->add(b.getId(), b.getAuthor());
+            return true;
+        });
+        index->save(authorIndexName(filename), stamp);
+    }
+    cachedFile = filename;
+    cachedStamp = stamp;
+    return *index;
 }
 
 /* ------------------------
@@ -187,6 +1008,7 @@ bool fileIsEmpty(const string& filename) {
 }
 
 void seedLibrary(const string& filename) {
+    FileLock lock(filename, FileLock::Exclusive);
     if (!fileIsEmpty(filename)) return;
 
     vector<pair<string, string>> initial = {
@@ -211,126 +1033,5394 @@ void seedLibrary(const string& filename) {
         {"The Last Olympian", "Rick Riordan"}
     };
 
-    ofstream out(filename, ios::trunc);
-    if (!out) {
-        cerr << "\nError: Could not open " << filename << " for seeding.\n";
-        return;
-    }
+    vector<Book> books;
     int id = 1;
     for (auto& p : initial) {
-        Book b(id++, p.first, p.second, false);
-        out << b.serialize() << "\n";
+        books.emplace_back(id++, p.first, p.second, false);
+    }
+    if (!overwriteDatabase(filename, books)) {
+        cerr << "\nError: Could not seed " << filename << ".\n";
+        return;
     }
     cout << "\nSeeded initial library with " << initial.size() << " books.\n";
 }
 
 /* ------------------------
- * Utility Functions
+ * Mutation Log
  * ------------------------
  */
-void listBooks(const string& filename) {
-    vector<Book> books = loadBooks(filename);
+// Every change to a catalog file is also appended to "<file>.log", one line each:
+//     seq <TAB> unix time in ms <TAB> ADD|OUT|IN|DEL <TAB> id [<TAB> title <TAB> author]
+// Lines are appended under the Exclusive FileLock right after the file itself
+// is saved, so sequence numbers are unique across processes, and the file and
+// the log's last sequence number always describe the same state. A standby
+// (see runStandby) replays the log to keep its own copy of the catalog current.
+enum class MutationType { Add, CheckOut, CheckIn, Delete };
 
-    if (books.empty()) {
-        cout << "\nNo books in the library yet." << endl;
-        return;
-    }
+struct Mutation {
+    uint64_t seq = 0;
+    uint64_t order = 0;     // when the catalog made the change; not logged
+    int64_t timeMs = 0;
+    MutationType type = MutationType::Add;
+    int id = 0;
+    string title;
+    string author;
+};
 
-    cout << "\nBooks in the library:" << endl;
-    for (const auto& b : books) {
-        cout << "ID: " << b.getId()
-            << " | Title: " << b.getTitle()
-            << " | Author: " << b.getAuthor()
-            << " | Status: " << (b.getCheckedOut() ? "Checked Out" : "Available")
-            << endl;
-    }
+int64_t currentTimeMs() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
 }
 
-int getNextId(const string& filename) {
-    vector<Book> books = loadBooks(filename);
-    int maxId = 0;
-    for (const auto& b : books) {
-        if (b.getId() > maxId) {
-            maxId = b.getId();
-        }
-    }
-    return maxId + 1;
+Mutation makeMutation(MutationType type, int id, string title = {}, string author = {}) {
+    Mutation m;
+    m.timeMs = currentTimeMs();
+    m.type = type;
+    m.id = id;
+    m.title = std::move(title);
+    m.author = std::move(author);
+    return m;
 }
 
-bool updateBookStatus(const string& filename, int id, bool checkOut) {
-    vector<Book> books = loadBooks(filename);
-    bool found = false;
+string mutationLogName(const string& filename) {
+    return filename + ".log";
+}
 
-    for (auto& b : books) {
-        if (b.getId() == id) {
-            if (checkOut) b.checkOut();
-            else b.checkIn();
-            found = true;
-            break;
-        }
-    }
+const char* const MUTATION_TAGS[] = { "ADD", "OUT", "IN", "DEL" };
 
-    if (found) {
-        overwriteDatabase(filename, books);
-        cout << "\nUpdated book with ID " << id << " to "
-            << (checkOut ? "Checked Out" : "Available") << "." << endl;
-    }
-    else {
-        cout << "\nError: Book with ID " << id << " not found." << endl;
+// Fields are tab separated, so tabs and line breaks inside a title become spaces.
+void appendLogField(string& out, string_view text) {
+    out += '\t';
+    for (char c : text) out += (c == '\t' || c == '\n' || c == '\r') ? ' ' : c;
+}
+
+bool parseMutation(string_view line, Mutation& m) {
+    string_view fields[6];
+    size_t count = 0;
+    while (count < 6) {
+        size_t tab = line.find('\t');
+        fields[count++] = line.substr(0, tab);
+        if (tab == string_view::npos) break;
+        line.remove_prefix(tab + 1);
     }
+    if (count != 4 && count != 6) return false;
 
-    return found;
+    auto whole = [](string_view text, auto& value) {
+        auto result = from_chars(text.data(), text.data() + text.size(), value);
+        return !text.empty() && result.ec == errc() && result.ptr == text.data() + text.size();
+    };
+    if (!whole(fields[0], m.seq) || !whole(fields[1], m.timeMs) || !whole(fields[3], m.id)) return false;
+
+    auto tag = find(begin(MUTATION_TAGS), end(MUTATION_TAGS), fields[2]);
+    if (tag == end(MUTATION_TAGS)) return false;
+    m.type = static_cast<MutationType>(tag - begin(MUTATION_TAGS));
+    if ((m.type == MutationType::Add) != (count == 6)) return false;
+    m.title = count == 6 ? string(fields[4]) : string();
+    m.author = count == 6 ? string(fields[5]) : string();
+    return true;
 }
 
-bool deleteBookById(const string& filename, int id) {
-    vector<Book> books = loadBooks(filename);
-    bool found = false;
+// Sequence number of the last line in the log, or 0 if there is none. Only the
+// tail of the file is read. Callers hold the catalog's FileLock.
+uint64_t lastLoggedSeq(const string& filename) {
+    ifstream log(mutationLogName(filename), ios::binary | ios::ate);
+    if (!log) return 0;
+    const streamoff size = log.tellg();
+    string tail;
+    for (streamoff chunk = 4096; ; chunk *= 2) {
+        streamoff start = max<streamoff>(0, size - chunk);
+        tail.resize(static_cast<size_t>(size - start));
+        log.seekg(start);
+        log.read(&tail[0], static_cast<streamsize>(tail.size()));
 
-    auto it = remove_if(books.begin(), books.end(),
-        [&](const Book& b) { return b.getId() == id; });
+        size_t end = tail.find_last_not_of('\n');
+        size_t lineStart = (end == string::npos) ? string::npos : tail.rfind('\n', end);
+        if (lineStart == string::npos && start > 0) continue; // the last line is longer than chunk
+        if (end == string::npos) return 0;
 
-    if (it != books.end()) {
-        books.erase(it, books.end());
-        overwriteDatabase(filename, books);
-        cout << "\nDeleted book with ID " << id << " from the library." << endl;
-        found = true;
+        lineStart = (lineStart == string::npos) ? 0 : lineStart + 1;
+        uint64_t seq = 0;
+        from_chars(tail.data() + lineStart, tail.data() + end + 1, seq);
+        return seq;
     }
-    else {
-        cout << "\nError: Book with ID " << id << " not found, cannot delete." << endl;
+}
+
+// Numbers a batch of changes after the log's last entry and appends them.
+// Callers hold the Exclusive FileLock.
+bool appendMutations(const string& filename, vector<Mutation>& batch) {
+    if (batch.empty()) return true;
+    uint64_t seq = lastLoggedSeq(filename);
+    string out;
+    char digits[24];
+    for (auto& m : batch) {
+        m.seq = ++seq;
+        out.append(digits, to_chars(digits, digits + sizeof(digits), m.seq).ptr - digits);
+        out += '\t';
+        out.append(digits, to_chars(digits, digits + sizeof(digits), m.timeMs).ptr - digits);
+        out += '\t';
+        out += MUTATION_TAGS[static_cast<int>(m.type)];
+        out += '\t';
+        out.append(digits, to_chars(digits, digits + sizeof(digits), m.id).ptr - digits);
+        if (m.type == MutationType::Add) {
+            appendLogField(out, m.title);
+            appendLogField(out, m.author);
+        }
+        out += '\n';
     }
 
-    return found;
+    const string logName = mutationLogName(filename);
+    ofstream log(logName, ios::binary | ios::app);
+    log.write(out.data(), static_cast<streamsize>(out.size()));
+    log.close();
+    if (!log) {
+        cerr << "\nError: Could not append to " << logName << "." << endl;
+        return false;
+    }
+    return true;
 }
 
 /* ------------------------
- * Main Menu
+ * Utility Functions
  * ------------------------
  */
-int main() {
-    const string filename = "library.csv";
-    int choice;
+bool parseInt(string_view text, int& value) {
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return !text.empty() && result.ec == errc() && result.ptr == text.data() + text.size();
+}
 
-    // Seed initial library if empty
-    seedLibrary(filename);
+// Which books a listing shows.
+enum class ListFilter { All, Available, CheckedOut };
 
-    cout << "Welcome to the Library System!";
+bool matchesFilter(bool checkedOut, ListFilter filter) {
+    switch (filter) {
+    case ListFilter::Available: return !checkedOut;
+    case ListFilter::CheckedOut: return checkedOut;
+    default: return true;
+    }
+}
 
-    while (true) {
-        cout << "\n\n------------------------------" << endl;
-        cout << "What would you like to do?" << endl;
-        cout << "1. Add Book" << endl;
-        cout << "2. List Books" << endl;
-        cout << "3. Check Out Book" << endl;
-        cout << "4. Check In Book" << endl;
-        cout << "5. Delete Book" << endl;
-        cout << "6. Exit" << endl;
+// Outcome of a conditional check-out or check-in.
+enum class StatusChange {
+    Updated,
+    NotFound,
+    Unchanged   // the book was already in the requested state
+};
+
+// Drops repeated IDs, keeping the first occurrence of each.
+void removeDuplicateIds(vector<int>& ids) {
+    vector<int> seen;
+    seen.reserve(ids.size());
+    auto kept = remove_if(ids.begin(), ids.end(), [&](int id) {
+        auto at = lower_bound(seen.begin(), seen.end(), id);
+        if (at != seen.end() && *at == id) return true;
+        seen.insert(at, id);
+        return false;
+    });
+    ids.erase(kept, ids.end());
+}
+
+// Prints the result of checking out or returning a set of books. A failed batch
+// names only the book that stopped it, since none of the others were changed.
+bool reportStatusChanges(const vector<int>& ids, bool checkOut, StatusChange change, int failedId) {
+    if (change == StatusChange::Updated) {
+        for (int id : ids) {
+            cout << "\nUpdated book with ID " << id << " to "
+                << (checkOut ? "Checked Out" : "Available") << "." << endl;
+        }
+        return true;
+    }
+
+    if (change == StatusChange::NotFound) {
+        cout << "\nError: Book with ID " << failedId << " not found." << endl;
+    }
+    else {
+        cout << "\nError: Book with ID " << failedId << " is already "
+            << (checkOut ? "checked out" : "checked in") << "." << endl;
+    }
+    if (ids.size() > 1) cout << "No books were updated." << endl;
+    return false;
+}
+
+void listBooks(const string& filename) {
+    FileLock lock(filename, FileLock::Shared);
+    OutputBuffer out;
+    bool any = false;
+
+    LoadReport report = forEachBook(filename, [&](const Book& b) {
+        if (!any) {
+            out.append("\nBooks in the library:\n");
+            any = true;
+        }
+        b.print(out);
+        return true;
+    });
+    out.flush();
+    if (report.rejected() > 0) printLoadReport(report);
+
+    if (!any) {
+        cout << "\nNo books in the library yet." << endl;
+    }
+}
+
+// Callers hold a FileLock; take it Exclusive if the ID is about to be used.
+int getNextId(const string& filename) {
+    int maxId = 0;
+    forEachBook(filename, [&](const Book& b) {
+        if (b.getId() > maxId) {
+            maxId = b.getId();
+        }
+        return true;
+    });
+    return maxId + 1;
+}
+
+const char* const BAD_FIELD_MESSAGE = "Titles and authors cannot contain commas or line breaks.";
+
+// A title or author is written into library.csv as it is, so a comma or a line
+// break in it would split it into extra fields or extra rows.
+bool isStorableField(string_view text) {
+    return text.find_first_of(",\r\n") == string_view::npos;
+}
+
+// Allocates the next ID and appends the book under one exclusive lock, so two
+// terminals adding at the same moment cannot hand out the same ID. Returns -1,
+// adding nothing, if the title or author cannot be stored.
+int addBook(const string& filename, const string& title, const string& author) {
+    if (!isStorableField(title) || !isStorableField(author)) return -1;
+    FileLock lock(filename, FileLock::Exclusive);
+    int id = getNextId(filename);
+    FileStamp before = fileStamp(filename);
+    saveBook(filename, Book(id, title, author));
+    addToAuthorIndex(filename, before, id, author);
+    vector<Mutation> logged = { makeMutation(MutationType::Add, id, title, author) };
+    appendMutations(filename, logged);
+    return id;
+}
+
+// Prints up to pageSize books whose ID is greater than the cursor and that pass
+// the filter, and moves the cursor past the last book looked at. Returns true if
+// more books remain after this page.
+bool listBooksPage(const string& filename, int& cursor, size_t pageSize, ListFilter filter = ListFilter::All) {
+    FileLock lock(filename, FileLock::Shared);
+    const OffsetIndex& index = getOffsetIndex(filename);
+
+    auto it = upper_bound(index.entries.begin(), index.entries.end(), cursor,
+        [](int id, const pair<int, streamoff>& entry) { return id < entry.first; });
+
+    ifstream infile(filename, ios::binary);
+    OutputBuffer out;
+    string line;
+    Book b(0, "", "");
+    size_t shown = 0;
+
+    for (; it != index.entries.end() && shown < pageSize; ++it) {
+        infile.clear();
+        infile.seekg(it->second);
+        if (!getline(infile, line)) break;
+        if (Book::tryDeserialize(line, b) != ParseError::None) continue;
+
+        cursor = b.getId();
+        if (!matchesFilter(b.getCheckedOut(), filter)) continue;
+        b.print(out);
+        shown++;
+    }
+
+    out.flush();
+    return it != index.entries.end();
+}
+
+// Prints up to pageSize of the author's books after the cursor that pass the
+// filter, reading only their rows, and moves the cursor past the last book
+// looked at. Returns true if more of the author's books remain.
+bool listAuthorBooksPage(const string& filename, const string& author, ListFilter filter,
+    int& cursor, size_t pageSize) {
+    FileLock lock(filename, FileLock::Shared);
+    vector<int> ids = getAuthorIndex(filename).find(author);
+    const OffsetIndex& index = getOffsetIndex(filename);
+
+    ifstream infile(filename, ios::binary);
+    OutputBuffer out;
+    string line;
+    Book b(0, "", "");
+    size_t shown = 0;
+    auto it = upper_bound(ids.begin(), ids.end(), cursor);
+    for (; it != ids.end() && shown < pageSize; ++it) {
+        auto entry = lower_bound(index.entries.begin(), index.entries.end(), make_pair(*it, streamoff(0)));
+        if (entry == index.entries.end() || entry->first != *it) continue;
+        infile.clear();
+        infile.seekg(entry->second);
+        if (!getline(infile, line) || Book::tryDeserialize(line, b) != ParseError::None) continue;
+
+        cursor = b.getId();
+        if (!matchesFilter(b.getCheckedOut(), filter)) continue;
+        b.print(out);
+        shown++;
+    }
+    out.flush();
+    return it != ids.end();
+}
+
+// Checks out or returns every book in ids, or none of them. All IDs are checked
+// against one load of the file and the result is saved with a single rewrite.
+bool updateBooksStatus(const string& filename, vector<int> ids, bool checkOut) {
+    removeDuplicateIds(ids);
+    FileLock lock(filename, FileLock::Exclusive);
+    vector<string> rejected;
+    vector<Book> books = loadBooks(filename, &rejected);
+
+    vector<int> wanted(ids);
+    sort(wanted.begin(), wanted.end());
+    vector<int> present;
+    for (auto& b : books) {
+        if (!binary_search(wanted.begin(), wanted.end(), b.getId())) continue;
+        if (!(checkOut ? b.checkOut() : b.checkIn())) {
+            return reportStatusChanges(ids, checkOut, StatusChange::Unchanged, b.getId());
+        }
+        present.push_back(b.getId());
+    }
+
+    sort(present.begin(), present.end());
+    for (int id : ids) {
+        if (!binary_search(present.begin(), present.end(), id)) {
+            return reportStatusChanges(ids, checkOut, StatusChange::NotFound, id);
+        }
+    }
+
+    if (!overwriteDatabase(filename, books, rejected)) return false;
+    writeAuthorIndex(filename, books);
+    vector<Mutation> logged;
+    for (int id : ids) logged.push_back(makeMutation(checkOut ? MutationType::CheckOut : MutationType::CheckIn, id));
+    appendMutations(filename, logged);
+    return reportStatusChanges(ids, checkOut, StatusChange::Updated, 0);
+}
+
+bool updateBookStatus(const string& filename, int id, bool checkOut) {
+    return updateBooksStatus(filename, { id }, checkOut);
+}
+
+bool deleteBookById(const string& filename, int id) {
+    FileLock lock(filename, FileLock::Exclusive);
+    vector<string> rejected;
+    vector<Book> books = loadBooks(filename, &rejected);
+    bool found = false;
+
+    auto it = remove_if(books.begin(), books.end(),
+        [&](const Book& b) { return b.getId() == id; });
+
+    if (it != books.end()) {
+        books.erase(it, books.end());
+        if (!overwriteDatabase(filename, books, rejected)) return false;
+        writeAuthorIndex(filename, books);
+        vector<Mutation> logged = { makeMutation(MutationType::Delete, id) };
+        appendMutations(filename, logged);
+        cout << "\nDeleted book with ID " << id << " from the library." << endl;
+        found = true;
+    }
+    else {
+        cout << "\nError: Book with ID " << id << " not found, cannot delete." << endl;
+    }
+
+    return found;
+}
+
+/* ------------------------
+ * Text Search
+ * ------------------------
+ */
+// Calls emit with each word of text, lowercased. A word is a run of letters and
+// digits; bytes outside ASCII count as letters so accented titles still split
+// on spaces and punctuation.
+template <typename Emit>
+void forEachTerm(string_view text, Emit emit) {
+    string term;
+    for (size_t i = 0; i <= text.size(); i++) {
+        unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+        if (isalnum(c) || c >= 0x80) {
+            term += static_cast<char>(tolower(c));
+        }
+        else if (!term.empty()) {
+            emit(term);
+            term.clear();
+        }
+    }
+}
+
+// Distinct words of a book's title and author, sorted.
+vector<string> bookTerms(string_view title, string_view author) {
+    vector<string> terms;
+    auto add = [&](const string& term) { terms.push_back(term); };
+    forEachTerm(title, add);
+    forEachTerm(author, add);
+    sort(terms.begin(), terms.end());
+    terms.erase(unique(terms.begin(), terms.end()), terms.end());
+    return terms;
+}
+
+// A parsed search. Words next to each other must all match; OR separates
+// alternatives, so "potter OR hobbit tolkien" finds books matching "potter" or
+// both "hobbit" and "tolkien". A fuzzy search also accepts words a few typos
+// away from each query word.
+struct SearchQuery {
+    vector<vector<string>> groups;
+    bool fuzzy = false;
+
+    bool empty() const { return groups.empty(); }
+};
+
+SearchQuery parseSearchQuery(string_view text) {
+    SearchQuery query;
+    vector<string> group;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = min(text.find(' ', start), text.size());
+        string_view word = text.substr(start, end - start);
+        if (word == "OR") {
+            if (!group.empty()) query.groups.push_back(std::move(group));
+            group.clear();
+        }
+        else {
+            forEachTerm(word, [&](const string& term) { group.push_back(term); });
+        }
+        start = end + 1;
+    }
+    if (!group.empty()) query.groups.push_back(std::move(group));
+    return query;
+}
+
+// How many typos a fuzzy search forgives in a word: none up to two letters, one
+// up to five, two beyond that, so "tolkein" finds "tolkien" and "cervantez"
+// finds "cervantes".
+int allowedEdits(size_t length) {
+    return length <= 2 ? 0 : length <= 5 ? 1 : 2;
+}
+
+// One word of a fuzzy query, ready to be compared against many candidates. The
+// distance is Myers' bit-parallel Levenshtein (in Hyyro's form for whole-word
+// distance): one bit per letter of the query word, so each letter of the
+// candidate costs a handful of 64-bit operations. Words longer than 64 letters
+// only match exactly.
+class FuzzyWord {
+private:
+    string word;
+    int edits;
+    uint64_t masks[256] = {};   // bit i set where word[i] is that byte
+
+public:
+    explicit FuzzyWord(string text) : word(std::move(text)) {
+        edits = word.size() <= 64 ? allowedEdits(word.size()) : 0;
+        for (size_t i = 0; i < word.size() && i < 64; i++) {
+            masks[static_cast<unsigned char>(word[i])] |= uint64_t(1) << i;
+        }
+    }
+
+    const string& text() const { return word; }
+    int maxEdits() const { return edits; }
+
+    // Edit distance between the query word and term.
+    int distance(string_view term) const {
+        size_t m = word.size();
+        if (m == 0 || m > 64) return m == 0 ? static_cast<int>(term.size()) : (term == word ? 0 : numeric_limits<int>::max());
+        uint64_t last = uint64_t(1) << (m - 1);
+        uint64_t pv = ~uint64_t(0) >> (64 - m), mv = 0;
+        int score = static_cast<int>(m);
+        for (unsigned char c : term) {
+            uint64_t eq = masks[c];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            if (ph & last) score++;
+            else if (mh & last) score--;
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+        return score;
+    }
+
+    bool matches(string_view term) const {
+        size_t gap = term.size() > word.size() ? term.size() - word.size() : word.size() - term.size();
+        if (gap > static_cast<size_t>(edits)) return false;
+        return edits == 0 ? term == word : distance(term) <= edits;
+    }
+};
+
+// Checks one book against a query without an index, for file-mode searches.
+// fuzzyGroups holds the query's words prepared for a fuzzy search.
+bool matchesQuery(const SearchQuery& query, const vector<vector<FuzzyWord>>& fuzzyGroups,
+    string_view title, string_view author) {
+    vector<string> terms = bookTerms(title, author);
+    if (query.fuzzy) {
+        for (const auto& group : fuzzyGroups) {
+            bool all = all_of(group.begin(), group.end(), [&](const FuzzyWord& word) {
+                return any_of(terms.begin(), terms.end(), [&](const string& term) { return word.matches(term); });
+            });
+            if (all) return true;
+        }
+        return false;
+    }
+    for (const auto& group : query.groups) {
+        bool all = all_of(group.begin(), group.end(), [&](const string& term) {
+            return binary_search(terms.begin(), terms.end(), term);
+        });
+        if (all) return true;
+    }
+    return false;
+}
+
+// File-mode search: prints up to pageSize matching books after the cursor by
+// reading the whole file. Returns true if more matches remain.
+bool searchBooksPage(const string& filename, const SearchQuery& query, int& cursor, size_t pageSize) {
+    vector<vector<FuzzyWord>> fuzzyGroups;
+    if (query.fuzzy) {
+        for (const auto& group : query.groups) fuzzyGroups.emplace_back(group.begin(), group.end());
+    }
+    FileLock lock(filename, FileLock::Shared);
+    OutputBuffer out;
+    size_t shown = 0;
+    bool more = false;
+    forEachBook(filename, [&](const Book& b) {
+        if (b.getId() <= cursor || !matchesQuery(query, fuzzyGroups, b.getTitle(), b.getAuthor())) return true;
+        if (shown == pageSize) {
+            more = true;
+            return false;
+        }
+        b.print(out);
+        cursor = b.getId();
+        shown++;
+        return true;
+    });
+    out.flush();
+    return more;
+}
+
+void putVarint(string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+uint32_t getVarint(const string& in, size_t& pos) {
+    uint32_t value = 0;
+    for (int shift = 0; pos < in.size(); shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(in[pos++]);
+        value |= uint32_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return value;
+}
+
+// Inverted index from each word of a title or author to the IDs of the books
+// that contain it. A posting list stores its IDs in ascending order as varint
+// deltas, usually one or two bytes per book, with a skip entry every
+// SKIP_INTERVAL IDs so intersections can jump over runs that cannot match.
+//
+// New IDs are larger than any before them, so adding a book appends to the end
+// of each of its lists. Deleting one records a tombstone, with the lists that
+// still hold the book, instead of rewriting them; a list is compacted once a
+// quarter of its entries are dead, and adding a book back under the same ID
+// compacts its tombstoned lists first.
+//
+// Words are split over INDEX_STRIPES stripes, each with its own lock and its own
+// tombstones, so an entry is dead when the stripe of its list holds the book
+// dead. A change takes the lock of each stripe it touches in turn, and the word
+// lock too if it adds a word. A search shares the locks of its words' stripes,
+// or for a fuzzy search every lock.
+//
+// Fuzzy searches find their words through a second index, from each trigram of
+// each word (padded with two NULs on each side) to the numbers of the words
+// containing it. A word within k edits of a query word still shares all but at
+// most 3k of the query word's trigrams, so only words that reach that count are
+// compared with FuzzyWord. Words are never dropped from the index; an empty
+// list simply matches nothing.
+class TextIndex {
+private:
+    static const uint32_t SKIP_INTERVAL = 64;
+
+    struct Postings {
+        string bytes;
+        vector<pair<int, uint32_t>> skips;  // ID before each block, byte offset of the block
+        int lastId = 0;
+        uint32_t count = 0;
+        uint32_t dead = 0;
+
+        void append(int id) {
+            if (count % SKIP_INTERVAL == 0) skips.emplace_back(lastId, static_cast<uint32_t>(bytes.size()));
+            putVarint(bytes, static_cast<uint32_t>(id - lastId));
+            lastId = id;
+            count++;
+        }
+    };
+
+    // The words whose hash falls in one stripe, with their own lock. A stripe's
+    // tombstones are the removed books whose entries in its lists are stale.
+    struct Stripe {
+        unordered_map<string, Postings> terms;
+        unordered_map<int, vector<Postings*>> deleted; // removed book -> lists still holding it
+        mutable shared_mutex lock;
+
+        bool isDeleted(int id) const {
+            return !deleted.empty() && deleted.count(id) != 0;
+        }
+    };
+
+    // Walks one posting list in ID order.
+    struct Cursor {
+        const Postings* list;
+        const Stripe* stripe;
+        size_t pos = 0;
+        uint32_t index = 0;
+        int id = 0;
+
+        Cursor(const Postings* list, const Stripe* stripe) : list(list), stripe(stripe) {
+        }
+
+        bool next() {
+            if (index == list->count) return false;
+            id += static_cast<int>(getVarint(list->bytes, pos));
+            index++;
+            return true;
+        }
+
+        // Moves to the first ID at or after target. Returns false at the end.
+        bool seek(int target) {
+            if (index > 0 && id >= target) return true;
+            auto skip = lower_bound(list->skips.begin(), list->skips.end(), target,
+                [](const pair<int, uint32_t>& s, int t) { return s.first < t; });
+            if (skip != list->skips.begin()) {
+                --skip;
+                uint32_t block = static_cast<uint32_t>(skip - list->skips.begin()) * SKIP_INTERVAL;
+                if (block > index) {
+                    index = block;
+                    pos = skip->second;
+                    id = skip->first;
+                }
+            }
+            while (next()) {
+                if (id >= target) return true;
+            }
+            return false;
+        }
+    };
+
+    // Walks the union of several lists in ID order: a query word together with
+    // the spellings a fuzzy search accepts for it.
+    struct AnyCursor {
+        vector<Cursor> parts;
+        uint64_t count = 0;
+        int id = 0;
+
+        bool seek(int target) {
+            bool found = false;
+            for (auto& part : parts) {
+                if (!part.seek(target)) continue;
+                id = found ? min(id, part.id) : part.id;
+                found = true;
+            }
+            return found;
+        }
+
+        // Whether some list the cursor stands on holds id as a live entry.
+        bool liveAt(int id) const {
+            for (const auto& part : parts) {
+                if (part.index > 0 && part.id == id && !part.stripe->isDeleted(id)) return true;
+            }
+            return false;
+        }
+    };
+
+    using Term = pair<const string, Postings>;
+    using List = pair<const Postings*, const Stripe*>;
+
+    array<Stripe, INDEX_STRIPES> stripes;
+    vector<pair<const Term*, const Stripe*>> vocabulary; // every term, by number
+    unordered_map<uint32_t, vector<uint32_t>> trigrams;  // trigram -> word numbers
+    mutable shared_mutex wordsLock;                      // vocabulary and trigrams
+
+    // Distinct trigrams of a word, with two NULs of padding on each side.
+    static vector<uint32_t> trigramsOf(string_view word) {
+        string padded = string(2, '\0') + string(word) + string(2, '\0');
+        vector<uint32_t> grams;
+        for (size_t i = 0; i + 3 <= padded.size(); i++) {
+            grams.push_back(uint32_t(static_cast<unsigned char>(padded[i])) << 16
+                | uint32_t(static_cast<unsigned char>(padded[i + 1])) << 8
+                | static_cast<unsigned char>(padded[i + 2]));
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+    // Callers hold the term's stripe exclusively.
+    void indexWord(const Term& term, const Stripe& stripe) {
+        unique_lock<shared_mutex> guard(wordsLock);
+        uint32_t number = static_cast<uint32_t>(vocabulary.size());
+        vocabulary.emplace_back(&term, &stripe);
+        for (uint32_t gram : trigramsOf(term.first)) trigrams[gram].push_back(number);
+    }
+
+    // Calls change once for each stripe holding some of words, with that
+    // stripe's words.
+    template <typename Change>
+    void byStripe(vector<string> words, Change change) {
+        vector<pair<size_t, string>> split;
+        split.reserve(words.size());
+        for (auto& word : words) split.emplace_back(stripeOf(word), std::move(word));
+        sort(split.begin(), split.end());
+        vector<string> group;
+        group.reserve(split.size());
+        for (size_t i = 0; i < split.size(); i++) {
+            group.push_back(std::move(split[i].second));
+            if (i + 1 < split.size() && split[i + 1].first == split[i].first) continue;
+            change(stripes[split[i].first], group);
+            group.clear();
+        }
+    }
+
+    // The lists of every word close enough to the query word, found through
+    // the trigram index and confirmed with the edit distance.
+    void closeTerms(const FuzzyWord& word, vector<List>& lists) const {
+        if (word.maxEdits() == 0) {
+            const Stripe& stripe = stripes[stripeOf(word.text())];
+            auto it = stripe.terms.find(word.text());
+            if (it != stripe.terms.end()) lists.emplace_back(&it->second, &stripe);
+            return;
+        }
+        vector<uint32_t> grams = trigramsOf(word.text());
+        size_t lost = 3 * static_cast<size_t>(word.maxEdits());
+        vector<uint8_t> shared(vocabulary.size());
+        vector<uint32_t> candidates;
+        if (grams.size() <= lost) {
+            // Repetitive words like "aaaaaa" have too few trigrams to filter on.
+            for (uint32_t w = 0; w < vocabulary.size(); w++) candidates.push_back(w);
+            grams.clear();
+        }
+        size_t needed = grams.size() - min(lost, grams.size());
+        for (uint32_t gram : grams) {
+            auto it = trigrams.find(gram);
+            if (it == trigrams.end()) continue;
+            for (uint32_t w : it->second) {
+                if (++shared[w] == needed) candidates.push_back(w);
+            }
+        }
+        for (uint32_t w : candidates) {
+            const Term& term = *vocabulary[w].first;
+            if (term.second.count > term.second.dead && word.matches(term.first)) {
+                lists.emplace_back(&term.second, vocabulary[w].second);
+            }
+        }
+    }
+
+    // Re-encodes a list without the IDs its stripe holds dead, plus extra if
+    // given. A tombstone goes once no list holds its book any more.
+    static void rebuild(Stripe& stripe, Postings& list, int extra = 0) {
+        vector<int> ids;
+        Cursor cursor(&list, &stripe);
+        while (cursor.next()) {
+            auto dead = stripe.deleted.empty() ? stripe.deleted.end() : stripe.deleted.find(cursor.id);
+            if (dead == stripe.deleted.end()) {
+                ids.push_back(cursor.id);
+                continue;
+            }
+            vector<Postings*>& holding = dead->second;
+            holding.erase(std::remove(holding.begin(), holding.end(), &list), holding.end());
+            if (holding.empty()) stripe.deleted.erase(dead);
+        }
+        if (extra > 0) ids.insert(upper_bound(ids.begin(), ids.end(), extra), extra);
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        list = Postings();
+        for (int id : ids) list.append(id);
+    }
+
+    // Appends to out, in ID order, up to limit books after the cursor that
+    // contain every term in group, or for a fuzzy search a close spelling of it.
+    void matchGroup(const vector<string>& group, bool fuzzy, int cursor, size_t limit, vector<int>& out) const {
+        vector<AnyCursor> cursors;
+        vector<List> lists;
+        for (const auto& term : group) {
+            lists.clear();
+            if (fuzzy) {
+                closeTerms(FuzzyWord(term), lists);
+            }
+            else {
+                const Stripe& stripe = stripes[stripeOf(term)];
+                auto it = stripe.terms.find(term);
+                if (it != stripe.terms.end()) lists.emplace_back(&it->second, &stripe);
+            }
+            if (lists.empty()) return;
+            AnyCursor any;
+            for (const auto& list : lists) {
+                any.parts.emplace_back(list.first, list.second);
+                any.count += list.first->count;
+            }
+            cursors.push_back(std::move(any));
+        }
+        // Drive from the shortest list and seek the others.
+        sort(cursors.begin(), cursors.end(),
+            [](const AnyCursor& a, const AnyCursor& b) { return a.count < b.count; });
+
+        int target = max(cursor, 0) + 1;
+        while (out.size() < limit && cursors[0].seek(target)) {
+            int candidate = cursors[0].id;
+            bool all = true;
+            for (size_t i = 1; i < cursors.size() && all; i++) {
+                if (!cursors[i].seek(candidate)) return;
+                if (cursors[i].id != candidate) {
+                    all = false;
+                    candidate = cursors[i].id - 1; // nothing before this ID can match
+                }
+            }
+            if (all && all_of(cursors.begin(), cursors.end(), [&](const AnyCursor& c) { return c.liveAt(candidate); })) {
+                out.push_back(candidate);
+            }
+            target = candidate + 1;
+        }
+    }
+
+public:
+    void add(int id, string_view title, string_view author) {
+        byStripe(bookTerms(title, author), [&](Stripe& stripe, const vector<string>& words) {
+            unique_lock<shared_mutex> guard(stripe.lock);
+            auto dead = stripe.deleted.find(id);
+            if (dead != stripe.deleted.end()) {
+                // Purge the removed copy's entries while they still read as dead,
+                // or clearing the tombstone would bring them back.
+                vector<Postings*> holding = dead->second;
+                for (Postings* list : holding) rebuild(stripe, *list);
+                stripe.deleted.erase(id);
+            }
+            for (const auto& word : words) {
+                auto [it, added] = stripe.terms.try_emplace(word);
+                if (added) indexWord(*it, stripe);
+                Postings& list = it->second;
+                if (id > list.lastId) list.append(id);
+                else rebuild(stripe, list, id); // only when books arrive out of ID order
+            }
+        });
+    }
+
+    void remove(int id, string_view title, string_view author) {
+        byStripe(bookTerms(title, author), [&](Stripe& stripe, const vector<string>& words) {
+            unique_lock<shared_mutex> guard(stripe.lock);
+            for (const auto& word : words) {
+                auto it = stripe.terms.find(word);
+                if (it == stripe.terms.end()) continue;
+                Postings& list = it->second;
+                stripe.deleted[id].push_back(&list);
+                if (++list.dead < list.count && list.dead * 4 < list.count) continue;
+                rebuild(stripe, list);
+            }
+        });
+    }
+
+    // Fills ids with up to limit matching book IDs after the cursor, in ID order.
+    // Returns true if more matches remain.
+    bool search(const SearchQuery& query, int cursor, size_t limit, vector<int>& ids) const {
+        // An exact search reads only its own words' stripes; a fuzzy one may
+        // reach any word.
+        array<bool, INDEX_STRIPES> needed{};
+        for (const auto& words : query.groups) {
+            for (const auto& word : words) needed[stripeOf(word)] = true;
+        }
+        array<shared_lock<shared_mutex>, INDEX_STRIPES> guards;
+        for (size_t i = 0; i < INDEX_STRIPES; i++) {
+            if (needed[i] || query.fuzzy) guards[i] = shared_lock<shared_mutex>(stripes[i].lock);
+        }
+        shared_lock<shared_mutex> wordsGuard;
+        if (query.fuzzy) wordsGuard = shared_lock<shared_mutex>(wordsLock);
+        ids.clear();
+        vector<int> group;
+        for (const auto& words : query.groups) {
+            group.clear();
+            matchGroup(words, query.fuzzy, cursor, limit + 1, group);
+            vector<int> merged;
+            merged.reserve(ids.size() + group.size());
+            set_union(ids.begin(), ids.end(), group.begin(), group.end(), back_inserter(merged));
+            if (merged.size() > limit + 1) merged.resize(limit + 1);
+            ids.swap(merged);
+        }
+        bool more = ids.size() > limit;
+        if (more) ids.resize(limit);
+        return more;
+    }
+
+    size_t termCount() const {
+        shared_lock<shared_mutex> guard(wordsLock);
+        return vocabulary.size();
+    }
+};
+
+// Lowercases text and turns every run of other characters into one space, so
+// "The Lord of The Rings!" becomes "the lord of the rings".
+string normalizeKey(string_view text) {
+    string key;
+    forEachTerm(text, [&](const string& term) {
+        if (!key.empty()) key += ' ';
+        key += term;
+    });
+    return key;
+}
+
+const size_t PREFIX_WORD_STARTS = 4;
+const size_t DEFAULT_SUGGESTIONS = 10;
+
+// Where the normalized prefix starts the normalized key, at one of its first
+// PREFIX_WORD_STARTS words, or npos; "hob" and "the hob" both find "the hobbit".
+// When several words match, the one whose rest of the key sorts first wins;
+// suggestions are ordered by that text, as in PrefixIndex, so "the" lists
+// "the chamber of secrets" before "the giver".
+size_t prefixMatchAt(string_view key, string_view prefix) {
+    size_t best = string_view::npos;
+    size_t start = 0;
+    for (size_t word = 0; word < PREFIX_WORD_STARTS && start < key.size(); word++) {
+        if (key.compare(start, prefix.size(), prefix) == 0
+            && (best == string_view::npos || key.substr(start) < key.substr(best))) best = start;
+        start = key.find(' ', start);
+        if (start == string_view::npos) break;
+        start++;
+    }
+    return best;
+}
+
+// One autocomplete result: the book whose title or author starts with the prefix.
+struct Suggestion {
+    Book book;
+    bool author;
+
+    const string text() const { return author ? book.getAuthor() : book.getTitle(); }
+};
+
+// Prints one suggestion per line with the field it matched and a book carrying it.
+void printSuggestions(const vector<Suggestion>& suggestions) {
+    for (const auto& s : suggestions) {
+        cout << "  " << s.text() << "  (" << (s.author ? "author" : "title")
+            << ", ID " << s.book.getId() << ")" << endl;
+    }
+}
+
+// File-mode autocomplete: the first count distinct titles and authors matching
+// the prefix, alphabetically, found by reading the whole file.
+vector<Suggestion> suggestFromFile(const string& filename, string_view prefix, size_t count) {
+    string wanted = normalizeKey(prefix);
+    struct Found {
+        string matched; // the key from the matching word on
+        string key;
+        Suggestion suggestion;
+    };
+    vector<Found> found;
+    if (wanted.empty()) return {};
+    FileLock lock(filename, FileLock::Shared);
+    forEachBook(filename, [&](const Book& b) {
+        for (bool author : { false, true }) {
+            string key = normalizeKey(author ? b.getAuthor() : b.getTitle());
+            size_t at = prefixMatchAt(key, wanted);
+            if (at != string::npos) found.push_back({ key.substr(at), std::move(key), Suggestion{ b, author } });
+        }
+        return true;
+    });
+    stable_sort(found.begin(), found.end(),
+        [](const auto& a, const auto& b) { return a.matched < b.matched; });
+    // Each distinct title or author once, with the first book carrying it.
+    vector<Suggestion> result;
+    set<pair<string, bool>> shown;
+    for (size_t i = 0; i < found.size() && result.size() < count; i++) {
+        if (!shown.insert({ found[i].key, found[i].suggestion.author }).second) continue;
+        result.push_back(found[i].suggestion);
+    }
+    return result;
+}
+
+// Autocomplete index over normalized titles and authors. Each distinct title or
+// author is one key, shared by every book carrying it, and gets one entry per
+// word start (up to PREFIX_WORD_STARTS). Entries sort by the key text from that
+// word on, so a prefix lookup is a binary search followed by a short walk, and
+// an author with a thousand books is still walked past once. Entries carry the
+// first eight bytes of their text as an integer so most comparisons never leave
+// the array.
+//
+// Entries live in a few sorted runs of decreasing size. New keys collect in an
+// unsorted batch that the next lookup sorts into a run of its own, so loading a
+// whole catalog costs one sort. A run is merged into the one before it once it
+// reaches half that size, so a lookup searches O(log n) runs. Keys whose last
+// book is deleted are skipped until a merge drops their entries.
+//
+// Adding or deleting a book only queues the change, on one of INDEX_STRIPES
+// queues picked by book ID, so books changing on different catalog shards do
+// not wait for each other or for lookups. The next lookup applies the queues,
+// or the writer does once its queue reaches PREFIX_QUEUE_LIMIT.
+const size_t PREFIX_QUEUE_LIMIT = 1024;
+
+class PrefixIndex {
+private:
+    struct Entry {
+        uint64_t head;   // first eight bytes of the key from offset, big-endian
+        uint32_t key;
+        uint16_t offset;
+    };
+
+    struct Key {
+        string text;
+        bool author = false;
+        vector<int> ids; // empty once the key is dead
+        uint8_t entries = 0;
+    };
+
+    vector<Key> keys;
+    vector<uint32_t> freeKeys;
+    unordered_map<string, uint32_t> live[2]; // title keys, author keys
+    unordered_map<int, array<uint32_t, 2>> keysById; // each book's title, author key
+    vector<vector<Entry>> runs;              // each sorted, sizes decreasing
+    vector<Entry> unsorted;                  // added since the last lookup
+    size_t deadEntries = 0;
+    mutable shared_mutex lock;
+
+    // A book added (with its title and author keys) or deleted. A book's
+    // changes share a queue, so they are applied in the order they were made.
+    struct Change {
+        int id;
+        bool add;
+        string title, author;
+    };
+
+    struct Queue {
+        mutex lock;
+        vector<Change> changes;
+    };
+
+    array<Queue, INDEX_STRIPES> queues;
+    atomic<size_t> queued{ 0 };
+
+    static uint64_t headOf(string_view text) {
+        uint64_t head = 0;
+        for (size_t i = 0; i < 8; i++) head = (head << 8) | (i < text.size() ? static_cast<unsigned char>(text[i]) : 0);
+        return head;
+    }
+
+    string_view textOf(const Entry& e) const {
+        return string_view(keys[e.key].text).substr(e.offset);
+    }
+
+    // Equal heads mean equal first eight bytes (keys hold no NULs), so the text
+    // comparison starts after them.
+    bool less(const Entry& a, const Entry& b) const {
+        if (a.head != b.head) return a.head < b.head;
+        string_view x = textOf(a), y = textOf(b);
+        int order = x.substr(min<size_t>(8, x.size())).compare(y.substr(min<size_t>(8, y.size())));
+        return order != 0 ? order < 0 : a.key < b.key;
+    }
+
+    bool isDead(const Entry& e) const {
+        return keys[e.key].ids.empty();
+    }
+
+    // Merges the last run into the one before it while it is at least half its
+    // size, or all runs into one. Entries of dead keys are dropped along the way,
+    // and once no run can still hold them the keys themselves are reused.
+    void settle(bool everything = false) {
+        while (runs.size() > 1 && (everything || runs.back().size() * 2 >= runs[runs.size() - 2].size())) {
+            vector<Entry>& a = runs[runs.size() - 2];
+            vector<Entry>& b = runs.back();
+            vector<Entry> merged;
+            merged.reserve(a.size() + b.size());
+            merge(a.begin(), a.end(), b.begin(), b.end(), back_inserter(merged),
+                [this](const Entry& x, const Entry& y) { return less(x, y); });
+            size_t before = merged.size();
+            merged.erase(remove_if(merged.begin(), merged.end(),
+                [this](const Entry& e) { return isDead(e); }), merged.end());
+            deadEntries -= min(deadEntries, before - merged.size());
+            runs.pop_back();
+            runs.back().swap(merged);
+        }
+        if (everything && runs.size() <= 1) {
+            if (runs.size() == 1) {
+                runs[0].erase(remove_if(runs[0].begin(), runs[0].end(),
+                    [this](const Entry& e) { return isDead(e); }), runs[0].end());
+            }
+            deadEntries = 0;
+            freeKeys.clear();
+            for (uint32_t k = 0; k < keys.size(); k++) {
+                if (!keys[k].ids.empty()) continue;
+                keys[k].text = string();
+                freeKeys.push_back(k);
+            }
+        }
+    }
+
+    // Adds id to the key for text, creating the key and its entries if it is new.
+    uint32_t attach(int id, string text, bool author, vector<Entry>& run) {
+        auto found = live[author].find(text);
+        if (found != live[author].end()) {
+            keys[found->second].ids.push_back(id);
+            return found->second;
+        }
+        uint32_t k;
+        if (!freeKeys.empty()) {
+            k = freeKeys.back();
+            freeKeys.pop_back();
+        }
+        else {
+            k = static_cast<uint32_t>(keys.size());
+            keys.emplace_back();
+        }
+        Key& key = keys[k];
+        key.text = std::move(text);
+        key.author = author;
+        key.ids.assign(1, id);
+        key.entries = 0;
+        live[author].emplace(key.text, k);
+
+        size_t start = 0;
+        for (size_t word = 0; word < PREFIX_WORD_STARTS && start < key.text.size() && start <= UINT16_MAX; word++) {
+            run.push_back({ headOf(string_view(key.text).substr(start)), k, static_cast<uint16_t>(start) });
+            key.entries++;
+            start = key.text.find(' ', start);
+            if (start == string::npos) break;
+            start++;
+        }
+        return k;
+    }
+
+    void detach(int id, uint32_t k) {
+        Key& key = keys[k];
+        auto it = find(key.ids.begin(), key.ids.end(), id);
+        if (it == key.ids.end()) return;
+        *it = key.ids.back();
+        key.ids.pop_back();
+        if (key.ids.empty()) {
+            live[key.author].erase(key.text);
+            deadEntries += key.entries;
+        }
+    }
+
+    // Applies every queued change, leaving the new entries unsorted. Callers
+    // hold the lock exclusively.
+    void applyQueued() {
+        vector<Change> changes;
+        for (auto& queue : queues) {
+            {
+                lock_guard<mutex> guard(queue.lock);
+                changes.swap(queue.changes);
+            }
+            queued.fetch_sub(changes.size());
+            for (auto& change : changes) {
+                if (change.add) {
+                    keysById[change.id] = { attach(change.id, std::move(change.title), false, unsorted),
+                        attach(change.id, std::move(change.author), true, unsorted) };
+                    continue;
+                }
+                auto it = keysById.find(change.id);
+                if (it == keysById.end()) continue;
+                for (uint32_t k : it->second) detach(change.id, k);
+                keysById.erase(it);
+            }
+            changes.clear();
+        }
+    }
+
+    void enqueue(Change change) {
+        Queue& queue = queues[static_cast<size_t>(change.id) % INDEX_STRIPES];
+        {
+            lock_guard<mutex> guard(queue.lock);
+            queue.changes.push_back(std::move(change));
+            queued.fetch_add(1);
+            if (queue.changes.size() < PREFIX_QUEUE_LIMIT) return;
+        }
+        unique_lock<shared_mutex> guard(lock);
+        applyQueued();
+    }
+
+public:
+    void add(int id, string_view title, string_view author) {
+        if (id <= 0) return;
+        enqueue({ id, true, normalizeKey(title), normalizeKey(author) });
+    }
+
+    void remove(int id) {
+        if (id <= 0) return;
+        enqueue({ id, false, string(), string() });
+    }
+
+    // Applies the queued changes and sorts the entries they added into a run.
+    // Lookups call it every time, so it only takes the exclusive lock when there
+    // is something to do.
+    void flush() {
+        if (queued.load() == 0) {
+            shared_lock<shared_mutex> reading(lock);
+            if (unsorted.empty()) return;
+        }
+        unique_lock<shared_mutex> guard(lock);
+        applyQueued();
+        if (!unsorted.empty()) {
+            sort(unsorted.begin(), unsorted.end(), [this](const Entry& x, const Entry& y) { return less(x, y); });
+            runs.push_back(std::move(unsorted));
+            unsorted.clear();
+            settle();
+        }
+        size_t total = 0;
+        for (const auto& run : runs) total += run.size();
+        if (deadEntries * 4 > total) settle(true);
+    }
+
+    // Up to count (ID, is author) matches for the prefix, alphabetically by the
+    // matched text from the matching word on. Each distinct title or author
+    // appears once, with one of the books carrying it.
+    vector<pair<int, bool>> suggest(string_view prefix, size_t count) {
+        string wanted = normalizeKey(prefix);
+        vector<pair<int, bool>> result;
+        if (wanted.empty()) return result;
+
+        flush();
+        shared_lock<shared_mutex> guard(lock);
+        uint64_t head = headOf(wanted);
+        auto before = [&](const Entry& e) {
+            if (e.head != head) return e.head < head;
+            return textOf(e) < wanted;
+        };
+        vector<pair<const Entry*, const Entry*>> cursors;
+        for (const auto& run : runs) {
+            auto it = partition_point(run.begin(), run.end(), before);
+            if (it != run.end()) cursors.emplace_back(&*it, run.data() + run.size());
+        }
+
+        vector<uint32_t> seen;
+        while (result.size() < count) {
+            // Smallest entry across the runs that still matches the prefix.
+            const Entry* best = nullptr;
+            size_t bestRun = 0;
+            for (size_t i = 0; i < cursors.size(); i++) {
+                const Entry* e = cursors[i].first;
+                if (e == cursors[i].second || textOf(*e).substr(0, wanted.size()) != wanted) continue;
+                if (!best || less(*e, *best)) {
+                    best = e;
+                    bestRun = i;
+                }
+            }
+            if (!best) break;
+            cursors[bestRun].first++;
+            // A key can match at two word starts, as "the lord of the rings" does for "the".
+            if (isDead(*best) || find(seen.begin(), seen.end(), best->key) != seen.end()) continue;
+            seen.push_back(best->key);
+            result.emplace_back(keys[best->key].ids.front(), keys[best->key].author);
+        }
+        return result;
+    }
+};
+
+/* ------------------------
+ * Filter Expressions
+ * ------------------------
+ */
+// A filter names the books to list with comparisons joined by AND, OR and NOT,
+// with parentheses for grouping:
+//     status=available AND author~"Gaiman" AND id>1000
+// id takes = != < <= > >=; status takes = and != with available or checked-out;
+// title and author take = (the whole field) or ~ (contains) and !=, ignoring
+// case and extra spaces. Values with spaces go in double quotes.
+struct FilterExpr {
+    enum class Kind { And, Or, Not, Id, Status, Title, Author };
+
+    Kind kind = Kind::And;
+    vector<FilterExpr> children;    // And, Or, Not
+    int64_t low = 0, high = 0;      // Id: inclusive range
+    bool checkedOut = false;        // Status
+    bool contains = false;          // Title, Author: ~ rather than =
+    string text;                    // Title, Author: folded with authorKey
+    size_t slot = 0;                // Title, Author: index of its prepared bitset
+};
+
+class FilterParser {
+private:
+    string_view text;
+    size_t pos = 0;
+    size_t leaves = 0;
+    string error;
+
+    void skipSpaces() {
+        while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))) pos++;
+    }
+
+    bool fail(const string& message) {
+        if (error.empty()) error = message + " at position " + to_string(pos + 1) + ".";
+        return false;
+    }
+
+    // A bare word (letters, digits, - _ .) or a double-quoted string.
+    bool readWord(string& word) {
+        skipSpaces();
+        word.clear();
+        if (pos < text.size() && text[pos] == '"') {
+            size_t end = text.find('"', pos + 1);
+            if (end == string_view::npos) return fail("Unterminated quote");
+            word = string(text.substr(pos + 1, end - pos - 1));
+            pos = end + 1;
+            return true;
+        }
+        while (pos < text.size()) {
+            unsigned char c = static_cast<unsigned char>(text[pos]);
+            if (!isalnum(c) && c != '-' && c != '_' && c != '.' && c < 0x80) break;
+            word += static_cast<char>(c);
+            pos++;
+        }
+        return !word.empty() || fail("Expected a field or value");
+    }
+
+    // Consumes keyword (case-insensitive) if it comes next as a whole word.
+    bool keyword(string_view word) {
+        skipSpaces();
+        if (text.size() - pos < word.size()) return false;
+        for (size_t i = 0; i < word.size(); i++) {
+            if (toupper(static_cast<unsigned char>(text[pos + i])) != word[i]) return false;
+        }
+        size_t end = pos + word.size();
+        if (end < text.size() && (isalnum(static_cast<unsigned char>(text[end])) || text[end] == '_')) return false;
+        pos = end;
+        return true;
+    }
+
+    bool parseOr(FilterExpr& out) {
+        FilterExpr first;
+        if (!parseAnd(first)) return false;
+        if (!keyword("OR")) {
+            out = std::move(first);
+            return true;
+        }
+        out = FilterExpr();
+        out.kind = FilterExpr::Kind::Or;
+        out.children.push_back(std::move(first));
+        do {
+            out.children.emplace_back();
+            if (!parseAnd(out.children.back())) return false;
+        } while (keyword("OR"));
+        return true;
+    }
+
+    bool parseAnd(FilterExpr& out) {
+        FilterExpr first;
+        if (!parseUnary(first)) return false;
+        if (!keyword("AND")) {
+            out = std::move(first);
+            return true;
+        }
+        out = FilterExpr();
+        out.kind = FilterExpr::Kind::And;
+        out.children.push_back(std::move(first));
+        do {
+            out.children.emplace_back();
+            if (!parseUnary(out.children.back())) return false;
+        } while (keyword("AND"));
+        return true;
+    }
+
+    bool parseUnary(FilterExpr& out) {
+        if (keyword("NOT")) {
+            out = FilterExpr();
+            out.kind = FilterExpr::Kind::Not;
+            out.children.emplace_back();
+            return parseUnary(out.children.back());
+        }
+        skipSpaces();
+        if (pos < text.size() && text[pos] == '(') {
+            pos++;
+            if (!parseOr(out)) return false;
+            skipSpaces();
+            if (pos >= text.size() || text[pos] != ')') return fail("Expected )");
+            pos++;
+            return true;
+        }
+        return parseComparison(out);
+    }
+
+    bool parseComparison(FilterExpr& out) {
+        string field;
+        if (!readWord(field)) return false;
+        for (auto& c : field) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+
+        skipSpaces();
+        static const char* const OPERATORS[] = { "!=", "<=", ">=", "=", "<", ">", "~" };
+        string op;
+        for (const char* candidate : OPERATORS) {
+            if (text.compare(pos, strlen(candidate), candidate) == 0) {
+                op = candidate;
+                pos += op.size();
+                break;
+            }
+        }
+        if (op.empty()) return fail("Expected =, !=, <, <=, >, >= or ~");
+        string value;
+        if (!readWord(value)) return false;
+
+        FilterExpr leaf;
+        bool negate = op == "!=";
+        if (field == "id") {
+            int id = 0;
+            if (!parseInt(value, id)) return fail("Expected a book ID");
+            if (op == "~") return fail("id cannot use ~");
+            leaf.kind = FilterExpr::Kind::Id;
+            leaf.low = (op == ">" ? int64_t(id) + 1 : op == ">=" || op == "=" || op == "!=" ? id : INT64_MIN);
+            leaf.high = (op == "<" ? int64_t(id) - 1 : op == "<=" || op == "=" || op == "!=" ? id : INT64_MAX);
+        }
+        else if (field == "status") {
+            string folded = authorKey(value);
+            if (op != "=" && op != "!=") return fail("status only takes = and !=");
+            if (folded == "available" || folded == "in") leaf.checkedOut = false;
+            else if (folded == "checked-out" || folded == "checkedout" || folded == "out") leaf.checkedOut = true;
+            else return fail("status is available or checked-out");
+            leaf.kind = FilterExpr::Kind::Status;
+        }
+        else if (field == "title" || field == "author") {
+            if (op != "=" && op != "!=" && op != "~") return fail(field + " only takes =, != and ~");
+            leaf.kind = field == "title" ? FilterExpr::Kind::Title : FilterExpr::Kind::Author;
+            leaf.contains = op == "~";
+            leaf.text = authorKey(value);
+            leaf.slot = leaves++;
+        }
+        else {
+            return fail("Unknown field \"" + field + "\" (use id, status, title or author)");
+        }
+
+        if (!negate) {
+            out = std::move(leaf);
+            return true;
+        }
+        out = FilterExpr();
+        out.kind = FilterExpr::Kind::Not;
+        out.children.push_back(std::move(leaf));
+        return true;
+    }
+
+public:
+    // Parses a whole filter. On failure, error says what was wrong and where.
+    bool parse(string_view input, FilterExpr& out, string& message) {
+        text = input;
+        pos = 0;
+        leaves = 0;
+        error.clear();
+        bool ok = parseOr(out);
+        skipSpaces();
+        if (ok && pos < text.size()) ok = fail("Unexpected text");
+        message = error;
+        return ok;
+    }
+};
+
+bool parseFilter(string_view text, FilterExpr& out, string& error) {
+    return FilterParser().parse(text, out, error);
+}
+
+// Evaluates a filter against one book, for file mode.
+bool matchesFilterExpr(const FilterExpr& e, const Book& b) {
+    switch (e.kind) {
+    case FilterExpr::Kind::And:
+        return all_of(e.children.begin(), e.children.end(), [&](const FilterExpr& c) { return matchesFilterExpr(c, b); });
+    case FilterExpr::Kind::Or:
+        return any_of(e.children.begin(), e.children.end(), [&](const FilterExpr& c) { return matchesFilterExpr(c, b); });
+    case FilterExpr::Kind::Not:
+        return !matchesFilterExpr(e.children[0], b);
+    case FilterExpr::Kind::Id:
+        return b.getId() >= e.low && b.getId() <= e.high;
+    case FilterExpr::Kind::Status:
+        return b.getCheckedOut() == e.checkedOut;
+    default: {
+        string field = authorKey(e.kind == FilterExpr::Kind::Title ? b.getTitle() : b.getAuthor());
+        return e.contains ? field.find(e.text) != string::npos : field == e.text;
+    }
+    }
+}
+
+// File-mode filter: prints up to pageSize matching books after the cursor by
+// reading the whole file. Returns true if more matches remain.
+bool filterBooksPage(const string& filename, const FilterExpr& filter, int& cursor, size_t pageSize) {
+    FileLock lock(filename, FileLock::Shared);
+    OutputBuffer out;
+    size_t shown = 0;
+    bool more = false;
+    forEachBook(filename, [&](const Book& b) {
+        if (b.getId() <= cursor || !matchesFilterExpr(filter, b)) return true;
+        if (shown == pageSize) {
+            more = true;
+            return false;
+        }
+        b.print(out);
+        cursor = b.getId();
+        shown++;
+        return true;
+    });
+    out.flush();
+    return more;
+}
+
+// Finds needle in haystack from a position, like string_view::find but using
+// the C library's memmem where there is one, which is several times faster on
+// long texts.
+size_t findBytes(string_view haystack, string_view needle, size_t from) {
+#if defined(__GLIBC__)
+    if (from > haystack.size()) return string_view::npos;
+    const void* found = memmem(haystack.data() + from, haystack.size() - from, needle.data(), needle.size());
+    return found ? static_cast<size_t>(static_cast<const char*>(found) - haystack.data()) : string_view::npos;
+#else
+    return haystack.find(needle, from);
+#endif
+}
+
+// Index of the lowest set bit; bits must not be zero.
+inline unsigned lowestBit(uint64_t bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(bits));
+#endif
+}
+
+// The catalog's fields laid out by column, for filters. Each book added gets
+// the next row, so the columns stay as long as the catalog however large its
+// IDs are. A filter is evaluated FILTER_BLOCK_ROWS rows at a time into
+// bitmasks: status is a copy of the status bitmap, an ID comparison reads the
+// ID column, and a title or author comparison is decided once per distinct
+// author (or once over all titles) before the scan and then read per row from
+// a bitmap. AND, OR and NOT combine whole masks, 64 books per instruction.
+//
+// Rows are normally in ID order, since books are loaded in file order and new
+// books get new IDs, and then a page starts at a binary search and stops once
+// it is full. A book added below the highest ID (an unsorted file, or a
+// replayed re-add) clears that, and pages scan every row and sort what passed.
+//
+// Authors are dictionary coded; titles are kept in one buffer, one per row,
+// separated by NULs, so "contains" is a single memmem pass. Rows and text of
+// deleted books stay until the catalog is reloaded. Status words are atomic and
+// are allocated a block at a time and never moved, so adding a book hands back
+// its bit, which the catalog keeps on the record and flips on a check-out
+// without taking the store's lock. Adding or deleting a book takes it
+// exclusively.
+const size_t FILTER_BLOCK_ROWS = 4096;
+const size_t FILTER_BLOCK_WORDS = FILTER_BLOCK_ROWS / 64;
+
+class ColumnStore {
+public:
+    // A book's place in the columns.
+    struct Row {
+        atomic<uint64_t>* word = nullptr;       // its checked-out bit's word
+        uint64_t bit = 0;
+        size_t row = 0;
+    };
+
+private:
+    size_t capacity = 0;                        // rows, a multiple of FILTER_BLOCK_ROWS
+    size_t rows = 0;
+    vector<int> idOf;                           // book ID by row
+    vector<uint64_t> live;
+    vector<unique_ptr<atomic<uint64_t>[]>> out; // checked-out bits, FILTER_BLOCK_ROWS to a block
+    vector<uint32_t> authorOf;                  // author code by row
+    bool ordered = true;                        // idOf ascending
+
+    unordered_map<string, uint32_t> authorCodes;
+    string authorText = string(1, '\0');        // every author, each followed by a NUL
+    vector<uint64_t> authorStart;
+    string titleText = string(1, '\0');         // the title of every row, the same way
+    vector<uint64_t> titleStart;
+    mutable shared_mutex lock;
+
+    void grow() {
+        if (rows < capacity) return;
+        size_t bigger = max(FILTER_BLOCK_ROWS, capacity * 2);
+        while (out.size() < bigger / FILTER_BLOCK_ROWS) {
+            out.emplace_back(new atomic<uint64_t>[FILTER_BLOCK_WORDS]);
+            for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++) out.back()[w].store(0, memory_order_relaxed);
+        }
+        live.resize(bigger / 64);
+        idOf.resize(bigger);
+        authorOf.resize(bigger);
+        capacity = bigger;
+    }
+
+    // Sets a bit for each entry of a NUL-separated buffer that equals text or,
+    // with contains, holds it.
+    static void matchText(const string& buffer, const vector<uint64_t>& starts, const FilterExpr& leaf,
+        vector<uint64_t>& entries) {
+        entries.assign((starts.size() + 63) / 64, 0);
+        string needle = leaf.contains ? leaf.text : string(1, '\0') + leaf.text + '\0';
+        if (needle.empty()) {
+            fill(entries.begin(), entries.end(), ~uint64_t(0));
+            return;
+        }
+        size_t at = findBytes(buffer, needle, 0);
+        while (at != string::npos) {
+            size_t start = leaf.contains ? at : at + 1;
+            size_t entry = static_cast<size_t>(upper_bound(starts.begin(), starts.end(), start) - starts.begin()) - 1;
+            entries[entry / 64] |= uint64_t(1) << (entry % 64);
+            size_t next = entry + 1 < starts.size() ? starts[entry + 1] : buffer.size();
+            at = findBytes(buffer, needle, leaf.contains ? next : next - 1);
+        }
+    }
+
+    // Works out, before the scan, which authors and which rows' titles each
+    // text comparison accepts.
+    void prepare(const FilterExpr& e, vector<vector<uint64_t>>& prepared) const {
+        for (const auto& child : e.children) prepare(child, prepared);
+        if (e.kind == FilterExpr::Kind::Author) {
+            if (prepared.size() <= e.slot) prepared.resize(e.slot + 1);
+            if (e.contains) {
+                matchText(authorText, authorStart, e, prepared[e.slot]);
+            }
+            else {
+                prepared[e.slot].assign((authorStart.size() + 63) / 64, 0);
+                auto it = authorCodes.find(e.text);
+                if (it != authorCodes.end()) prepared[e.slot][it->second / 64] |= uint64_t(1) << (it->second % 64);
+            }
+        }
+        else if (e.kind == FilterExpr::Kind::Title) {
+            if (prepared.size() <= e.slot) prepared.resize(e.slot + 1);
+            matchText(titleText, titleStart, e, prepared[e.slot]);
+            prepared[e.slot].resize(capacity / 64);
+        }
+    }
+
+    // Fills mask with the filter's result for the block starting at row base.
+    void evaluate(const FilterExpr& e, size_t base, const vector<vector<uint64_t>>& prepared, uint64_t* mask) const {
+        const size_t firstWord = base / 64;
+        switch (e.kind) {
+        case FilterExpr::Kind::And:
+        case FilterExpr::Kind::Or: {
+            bool isAnd = e.kind == FilterExpr::Kind::And;
+            evaluate(e.children[0], base, prepared, mask);
+            uint64_t other[FILTER_BLOCK_WORDS];
+            for (size_t c = 1; c < e.children.size(); c++) {
+                if (isAnd && all_of(mask, mask + FILTER_BLOCK_WORDS, [](uint64_t w) { return w == 0; })) return;
+                evaluate(e.children[c], base, prepared, other);
+                for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++) mask[w] = isAnd ? mask[w] & other[w] : mask[w] | other[w];
+            }
+            return;
+        }
+        case FilterExpr::Kind::Not:
+            evaluate(e.children[0], base, prepared, mask);
+            for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++) mask[w] = ~mask[w];
+            return;
+        case FilterExpr::Kind::Id: {
+            const int* ids = idOf.data() + base;
+            for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++) {
+                uint64_t bits = 0;
+                for (size_t j = 0; j < 64; j++) {
+                    int64_t id = ids[w * 64 + j];
+                    bits |= uint64_t(id >= e.low && id <= e.high) << j;
+                }
+                mask[w] = bits;
+            }
+            return;
+        }
+        case FilterExpr::Kind::Status:
+            for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++) {
+                uint64_t bits = out[base / FILTER_BLOCK_ROWS][w].load(memory_order_relaxed);
+                mask[w] = e.checkedOut ? bits : ~bits;
+            }
+            return;
+        case FilterExpr::Kind::Title:
+            copy_n(prepared[e.slot].begin() + static_cast<ptrdiff_t>(firstWord), FILTER_BLOCK_WORDS, mask);
+            return;
+        case FilterExpr::Kind::Author: {
+            const uint64_t* accepted = prepared[e.slot].data();
+            const uint32_t* codes = authorOf.data() + base;
+            for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++) {
+                uint64_t bits = 0;
+                for (size_t j = 0; j < 64; j++) {
+                    uint32_t code = codes[w * 64 + j];
+                    bits |= (accepted[code / 64] >> (code % 64) & 1) << j;
+                }
+                mask[w] = bits;
+            }
+            return;
+        }
+        }
+    }
+
+public:
+    Row add(int id, string_view title, string_view author, bool checkedOut) {
+        if (id <= 0) return Row();
+        string authorFolded = authorKey(author), titleFolded = authorKey(title);
+        unique_lock<shared_mutex> guard(lock);
+        grow();
+        size_t row = rows++;
+        Row place{ &out[row / FILTER_BLOCK_ROWS][row % FILTER_BLOCK_ROWS / 64], uint64_t(1) << (row % 64), row };
+        if (row > 0 && id <= idOf[row - 1]) ordered = false;
+        idOf[row] = id;
+        live[row / 64] |= place.bit;
+        setStatus(place, checkedOut);
+
+        auto [code, added] = authorCodes.try_emplace(std::move(authorFolded), static_cast<uint32_t>(authorStart.size()));
+        if (added) {
+            authorStart.push_back(authorText.size());
+            authorText += code->first;
+            authorText += '\0';
+        }
+        authorOf[row] = code->second;
+
+        titleStart.push_back(titleText.size());
+        titleText += titleFolded;
+        titleText += '\0';
+        return place;
+    }
+
+    void remove(const Row& place) {
+        if (!place.word) return;
+        unique_lock<shared_mutex> guard(lock);
+        live[place.row / 64] &= ~place.bit;
+    }
+
+    // Needs no lock: the word stays where it is for the life of the store.
+    static void setStatus(const Row& place, bool checkedOut) {
+        if (!place.word) return;
+        if (checkedOut) place.word->fetch_or(place.bit, memory_order_relaxed);
+        else place.word->fetch_and(~place.bit, memory_order_relaxed);
+    }
+
+    // Fills ids with up to limit matching IDs after the cursor, in ID order.
+    // Returns true if more matches remain.
+    bool select(const FilterExpr& filter, int cursor, size_t limit, vector<int>& ids) const {
+        shared_lock<shared_mutex> guard(lock);
+        ids.clear();
+        if (rows == 0) return false;
+        vector<vector<uint64_t>> prepared;
+        prepare(filter, prepared);
+
+        // In ID order the page starts at the first row after the cursor and ends
+        // once it is full; otherwise every row is looked at.
+        size_t start = ordered ? static_cast<size_t>(upper_bound(idOf.begin(), idOf.begin() + rows, cursor) - idOf.begin()) : 0;
+        uint64_t mask[FILTER_BLOCK_WORDS];
+        for (size_t base = start / FILTER_BLOCK_ROWS * FILTER_BLOCK_ROWS; base < rows; base += FILTER_BLOCK_ROWS) {
+            evaluate(filter, base, prepared, mask);
+            for (size_t w = 0; w < FILTER_BLOCK_WORDS; w++) {
+                uint64_t bits = mask[w] & live[base / 64 + w];
+                size_t first = base + w * 64;
+                if (first + 64 <= start) continue;
+                if (first < start) bits &= ~uint64_t(0) << (start - first);
+                for (; bits; bits &= bits - 1) {
+                    int id = idOf[first + lowestBit(bits)];
+                    if (ordered && ids.size() == limit) return true;
+                    if (id > cursor) ids.push_back(id);
+                }
+            }
+        }
+        if (ordered) return false;
+        sort(ids.begin(), ids.end());
+        bool more = ids.size() > limit;
+        if (more) ids.resize(limit);
+        return more;
+    }
+};
+
+/* ------------------------
+ * Sorted Listings
+ * ------------------------
+ */
+// Listings can be sorted by title, author or status. Titles and authors sort by
+// a collation key: the normalized words of the text with a leading "the", "a"
+// or "an" dropped, so "The Hobbit" files under H. Ties go to the other field and
+// then to the ID, so every order is total and paging through it is stable. The
+// status order puts books on the shelf first, each half in title order.
+enum class SortOrder { Title, Author, Status };
+
+const size_t SORT_ORDERS = 3;
+
+bool parseSortOrder(string_view text, SortOrder& order) {
+    if (text == "title") order = SortOrder::Title;
+    else if (text == "author") order = SortOrder::Author;
+    else if (text == "status") order = SortOrder::Status;
+    else return false;
+    return true;
+}
+
+const char* sortOrderName(SortOrder order) {
+    switch (order) {
+    case SortOrder::Author: return "author";
+    case SortOrder::Status: return "status";
+    default: return "title";
+    }
+}
+
+// Appends the collation key of text to key: the same words normalizeKey gives,
+// folded through a table straight into key, so building a million keys makes no
+// per-word strings or per-character library calls.
+void appendCollationKey(string& key, string_view text) {
+    static const array<char, 256> folded = [] {
+        array<char, 256> table{};
+        for (int c = 0; c < 256; c++) {
+            if (isalnum(c) || c >= 0x80) table[c] = static_cast<char>(tolower(c));
+        }
+        return table;
+    }();
+
+    size_t start = key.size();
+    bool gap = false;
+    for (char ch : text) {
+        char c = folded[static_cast<unsigned char>(ch)];
+        if (c != 0) {
+            if (gap && key.size() > start) key += ' ';
+            key += c;
+            gap = false;
+        }
+        else {
+            gap = true;
+        }
+    }
+    string_view words(key.data() + start, key.size() - start);
+    for (string_view article : { "the ", "a ", "an " }) {
+        if (words.size() > article.size() && words.compare(0, article.size(), article) == 0) {
+            key.erase(start, article.size());
+            break;
+        }
+    }
+}
+
+// Below this many items a sort is not worth starting threads for.
+const size_t PARALLEL_SORT_MIN = 1 << 16;
+
+// Sorts large inputs on every hardware thread: the items are cut into one run
+// per thread, each run is sorted on its own thread, and neighbouring runs are
+// then merged in pairs, also in parallel, until one run is left.
+template <typename T, typename Less>
+void parallelSort(vector<T>& items, Less less) {
+    size_t runs = min<size_t>(thread::hardware_concurrency(), items.size() / (PARALLEL_SORT_MIN / 4));
+    if (items.size() < PARALLEL_SORT_MIN || runs < 2) {
+        sort(items.begin(), items.end(), less);
+        return;
+    }
+
+    vector<size_t> bounds;
+    for (size_t i = 0; i <= runs; i++) bounds.push_back(items.size() * i / runs);
+    vector<thread> workers;
+    for (size_t i = 0; i < runs; i++) {
+        workers.emplace_back([&, i] { sort(items.begin() + bounds[i], items.begin() + bounds[i + 1], less); });
+    }
+    for (auto& worker : workers) worker.join();
+
+    vector<T> merged(items.size());
+    while (bounds.size() > 2) {
+        vector<size_t> next;
+        workers.clear();
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+            size_t first = bounds[i];
+            size_t middle = bounds[i + 1];
+            size_t last = bounds[min(i + 2, bounds.size() - 1)];
+            next.push_back(first);
+            workers.emplace_back([&, first, middle, last] {
+                merge(make_move_iterator(items.begin() + first), make_move_iterator(items.begin() + middle),
+                    make_move_iterator(items.begin() + middle), make_move_iterator(items.begin() + last),
+                    merged.begin() + first, less);
+            });
+        }
+        next.push_back(items.size());
+        for (auto& worker : workers) worker.join();
+        items.swap(merged);
+        bounds.swap(next);
+    }
+}
+
+// Collation keys for a set of books, packed into one buffer. Each entry keeps
+// the first eight bytes of its key as a big-endian integer, so most comparisons
+// are settled by one integer compare and the rest by a memcmp of what follows.
+class SortKeys {
+private:
+    struct Entry {
+        uint64_t head = 0;
+        size_t offset = 0;
+        uint32_t length = 0;
+        int id = 0;
+    };
+
+    string bytes;
+    vector<Entry> entries;
+
+public:
+    void reserve(size_t books) {
+        entries.reserve(books);
+        bytes.reserve(books * 48);
+    }
+
+    // Title order compares the title key and then the author key; author order
+    // the other way round. The NUL between them sorts below every key byte, so
+    // "dune" comes before "dune messiah" whoever wrote them.
+    void add(int id, string_view title, string_view author, SortOrder order) {
+        bool byAuthor = order == SortOrder::Author;
+        Entry e;
+        e.id = id;
+        e.offset = bytes.size();
+        appendCollationKey(bytes, byAuthor ? author : title);
+        bytes += '\0';
+        appendCollationKey(bytes, byAuthor ? title : author);
+        e.length = static_cast<uint32_t>(bytes.size() - e.offset);
+        for (size_t i = 0; i < 8 && i < e.length; i++) {
+            e.head |= uint64_t(static_cast<unsigned char>(bytes[e.offset + i])) << (56 - 8 * i);
+        }
+        entries.push_back(e);
+    }
+
+    // The IDs in key order.
+    vector<int> sortedIds() {
+        const char* base = bytes.data();
+        parallelSort(entries, [base](const Entry& a, const Entry& b) {
+            if (a.head != b.head) return a.head < b.head;
+            uint32_t shorter = min(a.length, b.length);
+            if (shorter > 8) {
+                int order = memcmp(base + a.offset + 8, base + b.offset + 8, shorter - 8);
+                if (order != 0) return order < 0;
+            }
+            if (a.length != b.length) return a.length < b.length;
+            return a.id < b.id;
+        });
+        vector<int> ids;
+        ids.reserve(entries.size());
+        for (const auto& e : entries) ids.push_back(e.id);
+        return ids;
+    }
+};
+
+// The file's book IDs in the given order, cached until the file changes.
+const vector<int>& getSortedIds(const string& filename, SortOrder order) {
+    struct Cached {
+        string filename;
+        FileStamp stamp;
+        bool built = false;
+        vector<int> ids;
+    };
+    static Cached cache[SORT_ORDERS];
+
+    FileStamp stamp = fileStamp(filename);
+    Cached& cached = cache[static_cast<size_t>(order)];
+    if (cached.built && cached.filename == filename && cached.stamp == stamp) return cached.ids;
+
+    SortKeys keys;
+    vector<int> checkedOut;
+    forEachBook(filename, [&](const Book& b) {
+        keys.add(b.getId(), b.getTitle(), b.getAuthor(), order == SortOrder::Author ? order : SortOrder::Title);
+        if (b.getCheckedOut()) checkedOut.push_back(b.getId());
+        return true;
+    });
+    cached.ids = keys.sortedIds();
+    if (order == SortOrder::Status) {
+        sort(checkedOut.begin(), checkedOut.end());
+        stable_partition(cached.ids.begin(), cached.ids.end(),
+            [&](int id) { return !binary_search(checkedOut.begin(), checkedOut.end(), id); });
+    }
+    cached.filename = filename;
+    cached.stamp = stamp;
+    cached.built = true;
+    return cached.ids;
+}
+
+// Prints up to pageSize books that pass the filter in the given order, starting
+// at position cursor of that order, and moves the cursor past the last book
+// looked at. Returns true if more books remain.
+bool listSortedBooksPage(const string& filename, SortOrder order, ListFilter filter,
+    int& cursor, size_t pageSize) {
+    FileLock lock(filename, FileLock::Shared);
+    const vector<int>& ids = getSortedIds(filename, order);
+    const OffsetIndex& index = getOffsetIndex(filename);
+
+    ifstream infile(filename, ios::binary);
+    OutputBuffer out;
+    string line;
+    Book b(0, "", "");
+    size_t shown = 0;
+    size_t at = static_cast<size_t>(max(cursor, 0));
+    for (; at < ids.size() && shown < pageSize; at++) {
+        auto entry = lower_bound(index.entries.begin(), index.entries.end(), make_pair(ids[at], streamoff(0)));
+        if (entry == index.entries.end() || entry->first != ids[at]) continue;
+        infile.clear();
+        infile.seekg(entry->second);
+        if (!getline(infile, line) || Book::tryDeserialize(line, b) != ParseError::None) continue;
+        if (!matchesFilter(b.getCheckedOut(), filter)) continue;
+        b.print(out);
+        shown++;
+    }
+    cursor = static_cast<int>(at);
+    out.flush();
+    return at < ids.size();
+}
+
+/* ------------------------
+ * Thread Pool
+ * ------------------------
+ */
+// Work-stealing pool. Every worker owns a deque: it pushes and pops its own
+// work at the back, while idle workers steal from the front of a randomly
+// chosen victim, so busy workers rarely contend with each other. Tasks
+// submitted from outside the pool are spread round-robin over the workers.
+class ThreadPool {
+public:
+    struct WorkerStats {
+        size_t queued;   // tasks waiting in this worker's deque right now
+        size_t executed; // tasks this worker has run
+        size_t steals;   // tasks this worker took from another worker's deque
+    };
+
+private:
+    struct Worker {
+        mutable mutex m;
+        deque<function<void()>> tasks;
+        atomic<size_t> executed{ 0 };
+        atomic<size_t> steals{ 0 };
+        thread handle;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    atomic<size_t> nextWorker{ 0 };
+    atomic<long> queued{ 0 };    // tasks sitting in some deque
+    atomic<long> pending{ 0 };   // tasks submitted but not yet finished
+    bool stopping = false;
+    mutex sleepMutex;
+    condition_variable wake;
+    condition_variable idle;
+
+    static size_t& currentIndex() {
+        static thread_local size_t index = SIZE_MAX;
+        return index;
+    }
+
+    static ThreadPool*& currentPool() {
+        static thread_local ThreadPool* pool = nullptr;
+        return pool;
+    }
+
+public:
+    explicit ThreadPool(size_t threadCount) {
+        threadCount = max<size_t>(threadCount, 1);
+        for (size_t i = 0; i < threadCount; i++) workers.push_back(make_unique<Worker>());
+        for (size_t i = 0; i < threadCount; i++) {
+            workers[i]->handle = thread([this, i] { run(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> guard(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& w : workers) w->handle.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    void submit(function<void()> task) {
+        size_t index = (currentPool() == this) ? currentIndex()
+            : nextWorker.fetch_add(1, memory_order_relaxed) % workers.size();
+        pending++;
+        {
+            lock_guard<mutex> guard(workers[index]->m);
+            workers[index]->tasks.push_back(std::move(task));
+        }
+        {
+            lock_guard<mutex> guard(sleepMutex);
+            queued++;
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until every submitted task has finished.
+    void waitIdle() {
+        unique_lock<mutex> guard(sleepMutex);
+        idle.wait(guard, [this] { return pending == 0; });
+    }
+
+    vector<WorkerStats> stats() const {
+        vector<WorkerStats> result;
+        for (const auto& w : workers) {
+            lock_guard<mutex> guard(w->m);
+            result.push_back({ w->tasks.size(), w->executed.load(), w->steals.load() });
+        }
+        return result;
+    }
+
+private:
+    bool popLocal(size_t index, function<void()>& task) {
+        Worker& w = *workers[index];
+        lock_guard<mutex> guard(w.m);
+        if (w.tasks.empty()) return false;
+        task = std::move(w.tasks.back());
+        w.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t thief, function<void()>& task, minstd_rand& random) {
+        size_t count = workers.size();
+        size_t start = random() % count;
+        for (size_t i = 0; i < count; i++) {
+            size_t victim = (start + i) % count;
+            if (victim == thief) continue;
+            Worker& w = *workers[victim];
+            lock_guard<mutex> guard(w.m);
+            if (w.tasks.empty()) continue;
+            task = std::move(w.tasks.front());
+            w.tasks.pop_front();
+            workers[thief]->steals++;
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t index) {
+        currentIndex() = index;
+        currentPool() = this;
+        minstd_rand random(static_cast<unsigned>(index + 1));
+        function<void()> task;
+
+        while (true) {
+            if (popLocal(index, task) || steal(index, task, random)) {
+                queued--;
+                task();
+                task = nullptr;
+                workers[index]->executed++;
+                if (pending.fetch_sub(1) == 1) {
+                    lock_guard<mutex> guard(sleepMutex);
+                    idle.notify_all();
+                }
+                continue;
+            }
+
+            unique_lock<mutex> guard(sleepMutex);
+            wake.wait(guard, [this] { return queued > 0 || stopping; });
+            if (stopping && queued <= 0) return;
+        }
+    }
+};
+
+/* ------------------------
+ * Epoch-Based Reclamation
+ * ------------------------
+ */
+// Lets readers walk shared catalog structures without taking any lock. A reader
+// publishes the global epoch it started in (EpochGuard). A writer that unlinks
+// a node passes it to retire() instead of deleting it. The epoch only moves on
+// once every active reader has caught up with it, so a node retired two epochs
+// ago can no longer be in any reader's hands and is freed.
+class EpochManager {
+public:
+    static const size_t MAX_THREADS = 256;
+
+private:
+    struct alignas(64) Slot {
+        atomic<uint64_t> epoch{ 0 }; // 0 while the thread is not reading
+        atomic<bool> inUse{ false };
+    };
+
+    struct Retired {
+        void* pointer;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    Slot slots[MAX_THREADS];
+    atomic<uint64_t> globalEpoch{ 1 };
+    mutex retireMutex;
+    vector<Retired> retired;
+
+    // Each thread claims a slot the first time it reads and gives it back on exit.
+    struct ThreadSlot {
+        size_t index = SIZE_MAX;
+        size_t depth = 0;
+        ~ThreadSlot() {
+            if (index != SIZE_MAX) EpochManager::instance().slots[index].inUse.store(false);
+        }
+    };
+
+    static ThreadSlot& threadSlot() {
+        static thread_local ThreadSlot slot;
+        if (slot.index == SIZE_MAX) {
+            EpochManager& manager = instance();
+            for (size_t i = 0; i < MAX_THREADS && slot.index == SIZE_MAX; i++) {
+                bool expected = false;
+                if (manager.slots[i].inUse.compare_exchange_strong(expected, true)) slot.index = i;
+            }
+            if (slot.index == SIZE_MAX) throw runtime_error("Too many threads reading the catalog.");
+        }
+        return slot;
+    }
+
+    bool tryAdvance() {
+        uint64_t current = globalEpoch.load();
+        for (const auto& slot : slots) {
+            uint64_t seen = slot.epoch.load();
+            if (seen != 0 && seen != current) return false;
+        }
+        return globalEpoch.compare_exchange_strong(current, current + 1);
+    }
+
+public:
+    ~EpochManager() {
+        for (auto& r : retired) r.deleter(r.pointer);
+    }
+
+    static EpochManager& instance() {
+        static EpochManager manager;
+        return manager;
+    }
+
+    void enter() {
+        ThreadSlot& slot = threadSlot();
+        if (slot.depth++ > 0) return;
+        // Re-check after publishing so the epoch cannot move on unseen between the
+        // load and the store.
+        uint64_t epoch;
+        do {
+            epoch = globalEpoch.load();
+            slots[slot.index].epoch.store(epoch);
+        } while (globalEpoch.load() != epoch);
+    }
+
+    void exit() {
+        ThreadSlot& slot = threadSlot();
+        if (--slot.depth > 0) return;
+        slots[slot.index].epoch.store(0, memory_order_release);
+    }
+
+    template <typename T>
+    void retire(T* pointer) {
+        lock_guard<mutex> guard(retireMutex);
+        retired.push_back({ pointer, [](void* p) { delete static_cast<T*>(p); }, globalEpoch.load() });
+        tryAdvance();
+
+        uint64_t safe = globalEpoch.load();
+        auto keep = partition(retired.begin(), retired.end(),
+            [safe](const Retired& r) { return r.epoch + 2 > safe; });
+        for (auto it = keep; it != retired.end(); ++it) it->deleter(it->pointer);
+        retired.erase(keep, retired.end());
+    }
+};
+
+class EpochGuard {
+public:
+    EpochGuard() { EpochManager::instance().enter(); }
+    ~EpochGuard() { EpochManager::instance().exit(); }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+/* ------------------------
+ * In-Memory Catalog
+ * ------------------------
+ */
+// One book as the in-memory catalog stores it. Everything but the checkout
+// status is fixed once the record is published, so readers can use it without a
+// lock; the status is a single atomic word.
+struct CatalogRecord {
+    const int id;
+    const string title;
+    const string author;
+    atomic<bool> checkedOut;
+    ColumnStore::Row column;   // set when the record is inserted, under its shard's lock
+
+    CatalogRecord(int id, string title, string author, bool checkedOut)
+        : id(id), title(std::move(title)), author(std::move(author)), checkedOut(checkedOut) {
+    }
+
+    Book toBook() const {
+        return Book(id, title, author, checkedOut.load(memory_order_acquire));
+    }
+};
+
+// Maps small integer keys to records through a directory of fixed-size chunks,
+// so a lookup is two array reads. Readers only need an EpochGuard. Writers must
+// be serialized by the caller; they publish new chunks, a bigger directory or a
+// new record with a single atomic store, and retire whatever they replace.
+class RecordTable {
+public:
+    static const int CHUNK_BITS = 12;
+    static const size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+
+private:
+    struct Chunk {
+        atomic<CatalogRecord*> slots[CHUNK_SIZE];
+        Chunk() {
+            for (auto& slot : slots) slot.store(nullptr, memory_order_relaxed);
+        }
+    };
+
+    struct Directory {
+        size_t size;
+        unique_ptr<atomic<Chunk*>[]> chunks;
+        explicit Directory(size_t size) : size(size), chunks(new atomic<Chunk*>[size]) {
+            for (size_t i = 0; i < size; i++) chunks[i].store(nullptr, memory_order_relaxed);
+        }
+    };
+
+    atomic<Directory*> directory;
+
+    atomic<CatalogRecord*>* slotFor(size_t key) const {
+        Directory* dir = directory.load(memory_order_acquire);
+        size_t chunk = key >> CHUNK_BITS;
+        if (chunk >= dir->size) return nullptr;
+        Chunk* c = dir->chunks[chunk].load(memory_order_acquire);
+        return c ? &c->slots[key & (CHUNK_SIZE - 1)] : nullptr;
+    }
+
+public:
+    RecordTable() : directory(new Directory(16)) {
+    }
+
+    ~RecordTable() {
+        Directory* dir = directory.load();
+        for (size_t i = 0; i < dir->size; i++) {
+            Chunk* c = dir->chunks[i].load();
+            if (!c) continue;
+            for (auto& slot : c->slots) delete slot.load();
+            delete c;
+        }
+        delete dir;
+    }
+
+    RecordTable(const RecordTable&) = delete;
+    RecordTable& operator=(const RecordTable&) = delete;
+
+    // Reader side. The record stays valid until the caller's EpochGuard ends.
+    CatalogRecord* find(size_t key) const {
+        atomic<CatalogRecord*>* slot = slotFor(key);
+        return slot ? slot->load(memory_order_acquire) : nullptr;
+    }
+
+    // Reader side. Whether any key in the chunk was ever published.
+    bool hasChunk(size_t chunk) const {
+        Directory* dir = directory.load(memory_order_acquire);
+        return chunk < dir->size && dir->chunks[chunk].load(memory_order_acquire) != nullptr;
+    }
+
+    // Reader side. Visits every record in key order.
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        Directory* dir = directory.load(memory_order_acquire);
+        for (size_t chunk = 0; chunk < dir->size; chunk++) {
+            Chunk* c = dir->chunks[chunk].load(memory_order_acquire);
+            if (!c) continue;
+            for (auto& slot : c->slots) {
+                CatalogRecord* r = slot.load(memory_order_acquire);
+                if (r) visit(*r);
+            }
+        }
+    }
+
+    // Writer side. Returns the record that held the key before, which the caller
+    // retires, or nullptr.
+    CatalogRecord* publish(size_t key, CatalogRecord* record) {
+        size_t chunk = key >> CHUNK_BITS;
+        Directory* dir = directory.load(memory_order_acquire);
+        if (chunk >= dir->size) {
+            size_t size = dir->size;
+            while (size <= chunk) size *= 2;
+            Directory* grown = new Directory(size);
+            for (size_t i = 0; i < dir->size; i++) {
+                grown->chunks[i].store(dir->chunks[i].load(memory_order_relaxed), memory_order_relaxed);
+            }
+            directory.store(grown, memory_order_release);
+            EpochManager::instance().retire(dir);
+            dir = grown;
+        }
+        if (!dir->chunks[chunk].load(memory_order_acquire)) {
+            dir->chunks[chunk].store(new Chunk(), memory_order_release);
+        }
+        return slotFor(key)->exchange(record, memory_order_acq_rel);
+    }
+
+    // Writer side. Returns the unlinked record for the caller to retire.
+    CatalogRecord* unpublish(size_t key) {
+        atomic<CatalogRecord*>* slot = slotFor(key);
+        return slot ? slot->exchange(nullptr, memory_order_acq_rel) : nullptr;
+    }
+};
+
+#ifndef _WIN32
+// Memory this process has written to privately. In a child just forked for a
+// background save, that is the pages copied on write since the fork, by either
+// side, plus the child's own buffers. Reads with plain system calls into a stack
+// buffer, so the child can call it. Linux only; 0 elsewhere.
+uint64_t privateDirtyBytes() {
+#ifdef __linux__
+    int fd = open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    char text[4096];
+    size_t size = 0;
+    ssize_t n;
+    while (size < sizeof(text) - 1 && ((n = read(fd, text + size, sizeof(text) - 1 - size)) > 0
+        || (n < 0 && errno == EINTR))) {
+        if (n > 0) size += static_cast<size_t>(n);
+    }
+    close(fd);
+    text[size] = '\0';
+    const char* field = strstr(text, "Private_Dirty:");
+    if (!field) return 0;
+    field += strlen("Private_Dirty:");
+    while (*field == ' ') field++;
+    uint64_t kilobytes = 0;
+    from_chars(field, text + size, kilobytes);
+    return kilobytes * 1024;
+#else
+    return 0;
+#endif
+}
+#endif
+
+// One partition of the catalog. Each shard has its own record table, writer
+// lock and dirty flag, padded onto separate cache lines, so changes on
+// different shards never wait for each other or bounce a shared cache line.
+// pending holds the shard's changes since the last save, in the order they
+// were made; it is guarded by writeMutex like the table.
+struct alignas(64) CatalogShard {
+    RecordTable table;
+    mutex writeMutex;
+    atomic<bool> dirty{ false };
+    atomic<size_t> count{ 0 };
+    vector<Mutation> pending;
+};
+
+// The whole catalog held in memory and loaded once. This is what the catalog
+// server works from, so requests never pay the cost of re-reading library.csv.
+//
+// Books are spread over shards by ID: book N lives in shard N % shardCount under
+// key N / shardCount. Consecutive IDs therefore land on different shards, and
+// each shard's table stays dense. Reads (pages and lookups) never take a lock;
+// they run under an EpochGuard. Every change locks only its own shard, marks it
+// dirty and queues a Mutation for the log; check-outs flip the record's status
+// word in place. persist() writes the catalog and the queued log lines back
+// if any shard is dirty, which lets the server commit a whole batch with one save.
+class Catalog {
+public:
+    static const size_t DEFAULT_SHARDS = 16;
+
+private:
+    string filename;
+    vector<unique_ptr<CatalogShard>> shards;
+    mutex persistMutex;
+    atomic<int> nextId{ 1 };
+    atomic<int> highestId{ 0 };
+    bool logging = true;
+
+public:
+    struct SnapshotReport {
+        bool ok = false;
+        size_t books = 0;
+        double seconds = 0.0;
+        uint64_t copyOnWriteBytes = 0;
+    };
+
+private:
+#ifndef _WIN32
+    pid_t saverPid = -1;                // background save in progress, if any
+    int saverPipe = -1;
+    vector<vector<Mutation>> saverLog;  // the changes its image covers, per shard
+#endif
+    mutable mutex reportMutex;
+    SnapshotReport lastSnapshot;
+    TextIndex textIndex;
+    PrefixIndex prefixIndex;
+    AuthorIndex authorIndex;
+    ColumnStore columns;
+    bool indexAuthors = true;   // off while loading with a saved author index
+    vector<string> rejectedLines; // rows the load could not parse, written back by saves
+
+    // Each sort order's IDs, kept until a book is added or deleted (for the
+    // status order, also until a status changes), so paging through a sorted
+    // listing or listing it again costs no sorting.
+    struct SortedIds {
+        uint64_t books = 0;
+        uint64_t statuses = 0;
+        shared_ptr<const vector<int>> ids;
+    };
+    mutable mutex sortMutex;
+    mutable SortedIds sorted[SORT_ORDERS];
+    atomic<uint64_t> bookChanges{ 0 };
+    atomic<uint64_t> statusChanges{ 0 };
+    atomic<uint64_t> changeOrder{ 0 };  // numbers logged changes across shards
+
+    CatalogShard& shardFor(int id) const {
+        return *shards[static_cast<size_t>(id) % shards.size()];
+    }
+
+    size_t keyFor(int id) const {
+        return static_cast<size_t>(id) / shards.size();
+    }
+
+    CatalogRecord* find(int id) const {
+        return id > 0 ? shardFor(id).table.find(keyFor(id)) : nullptr;
+    }
+
+    void raiseHighestId(int id) {
+        int seen = highestId.load();
+        while (id > seen && !highestId.compare_exchange_weak(seen, id)) {
+        }
+    }
+
+    // Visits records with an ID after the cursor in ID order until visit returns
+    // false. IDs go a round at a time, one table chunk from every shard, and a
+    // round no shard has a chunk for is skipped whole, so a few very high IDs
+    // cost nothing in between. Allocates nothing, as the background-save child
+    // needs. Callers hold an EpochGuard.
+    template <typename Visit>
+    void scanFrom(int cursor, Visit visit) const {
+        const size_t span = RecordTable::CHUNK_SIZE * shards.size();
+        const size_t highest = static_cast<size_t>(max(highestId.load(memory_order_acquire), 0));
+        size_t id = static_cast<size_t>(max(cursor, 0)) + 1;
+        while (id <= highest) {
+            size_t round = id / span;
+            size_t end = min((round + 1) * span, highest + 1);
+            bool used = false;
+            for (size_t i = 0; i < shards.size() && !used; i++) used = shards[i]->table.hasChunk(round);
+            for (; used && id < end; id++) {
+                CatalogRecord* r = find(static_cast<int>(id));
+                if (r && !visit(*r)) return;
+            }
+            id = end;
+        }
+    }
+
+    // Marks the shard dirty and queues the change for the log, numbered so the
+    // shards' queues can be merged back into the order the changes were made.
+    // Callers hold the shard's writeMutex.
+    void recordChange(CatalogShard& shard, Mutation change) {
+        if (!shard.dirty.load(memory_order_relaxed)) shard.dirty.store(true, memory_order_release);
+        if (!logging) return;
+        change.order = changeOrder.fetch_add(1, memory_order_relaxed);
+        shard.pending.push_back(std::move(change));
+    }
+
+    // The shards' queued changes as one batch, in the order they were made.
+    static vector<Mutation> inChangeOrder(vector<vector<Mutation>>& logged) {
+        vector<Mutation> batch;
+        for (auto& entries : logged) {
+            for (auto& m : entries) batch.push_back(std::move(m));
+        }
+        sort(batch.begin(), batch.end(), [](const Mutation& a, const Mutation& b) { return a.order < b.order; });
+        return batch;
+    }
+
+    void insert(CatalogRecord* record, bool logged) {
+        CatalogShard& shard = shardFor(record->id);
+        lock_guard<mutex> guard(shard.writeMutex);
+        CatalogRecord* previous = shard.table.publish(keyFor(record->id), record);
+        if (previous) {
+            textIndex.remove(previous->id, previous->title, previous->author);
+            prefixIndex.remove(previous->id);
+            if (indexAuthors) authorIndex.remove(previous->id, previous->author);
+            columns.remove(previous->column);
+            EpochManager::instance().retire(previous);
+        }
+        else {
+            shard.count++;
+        }
+        textIndex.add(record->id, record->title, record->author);
+        prefixIndex.add(record->id, record->title, record->author);
+        if (indexAuthors) authorIndex.add(record->id, record->author);
+        record->column = columns.add(record->id, record->title, record->author, record->checkedOut.load(memory_order_relaxed));
+        bookChanges.fetch_add(1, memory_order_release);
+        raiseHighestId(record->id);
+        if (logged) recordChange(shard, makeMutation(MutationType::Add, record->id, record->title, record->author));
+        else shard.dirty.store(true, memory_order_release);
+    }
+
+    // Puts changes taken for a save that failed back in front of anything queued
+    // since, for the next save to write.
+    void requeue(vector<vector<Mutation>>& logged) {
+        for (size_t i = 0; i < shards.size() && i < logged.size(); i++) {
+            lock_guard<mutex> guard(shards[i]->writeMutex);
+            logged[i].insert(logged[i].end(), make_move_iterator(shards[i]->pending.begin()),
+                make_move_iterator(shards[i]->pending.end()));
+            shards[i]->pending.swap(logged[i]);
+            logged[i].clear();
+        }
+        shards[0]->dirty.store(true);
+    }
+
+    // The IDs of every book in the given order, sorted again only if the catalog
+    // has changed since the last time. The versions are read before the scan, so
+    // a change made during it leaves the result marked stale. Callers hold
+    // sortMutex.
+    shared_ptr<const vector<int>> sortedIdsLocked(SortOrder order) const {
+        uint64_t books = bookChanges.load(memory_order_acquire);
+        uint64_t statuses = statusChanges.load(memory_order_acquire);
+        SortedIds& cached = sorted[static_cast<size_t>(order)];
+        if (cached.ids && cached.books == books && (order != SortOrder::Status || cached.statuses == statuses)) {
+            return cached.ids;
+        }
+
+        vector<int> ids;
+        if (order == SortOrder::Status) {
+            ids = *sortedIdsLocked(SortOrder::Title);
+            EpochGuard guard;
+            stable_partition(ids.begin(), ids.end(), [&](int id) {
+                CatalogRecord* r = find(id);
+                return r && !r->checkedOut.load(memory_order_acquire);
+            });
+        }
+        else {
+            SortKeys keys;
+            keys.reserve(size());
+            EpochGuard guard;
+            scanFrom(0, [&](const CatalogRecord& r) {
+                keys.add(r.id, r.title, r.author, order);
+                return true;
+            });
+            ids = keys.sortedIds();
+        }
+        cached.books = books;
+        cached.statuses = statuses;
+        cached.ids = make_shared<const vector<int>>(std::move(ids));
+        return cached.ids;
+    }
+
+    void raiseNextId() {
+        int next = nextId.load();
+        while (highestId.load() >= next && !nextId.compare_exchange_weak(next, highestId.load() + 1)) {
+        }
+    }
+
+public:
+    explicit Catalog(string filename, size_t shardCount = DEFAULT_SHARDS) : filename(std::move(filename)) {
+        for (size_t i = 0; i < max<size_t>(shardCount, 1); i++) shards.push_back(make_unique<CatalogShard>());
+    }
+
+    LoadReport load() {
+        FileLock lock(filename, FileLock::Shared);
+        return loadWhileLocked();
+    }
+
+    // For callers that already hold a FileLock on the catalog file. The author
+    // index saved with the file is used if it still matches; otherwise it is
+    // built while loading and saved for next time.
+    LoadReport loadWhileLocked() {
+        FileStamp stamp = fileStamp(filename);
+        bool savedAuthors = authorIndex.load(authorIndexName(filename), stamp);
+        indexAuthors = !savedAuthors;
+        rejectedLines.clear();
+        LoadOptions options;
+        options.keptRejects = &rejectedLines;
+        // A row repeating an earlier row's ID is kept as a rejected row rather
+        // than replacing that book, so a save cannot lose either of them.
+        options.idTaken = [this](int id) { return find(id) != nullptr; };
+        LoadReport report = forEachBook(filename, [&](const Book& b) {
+            insert(new CatalogRecord(b.getId(), b.getTitle(), b.getAuthor(), b.getCheckedOut()), false);
+            return true;
+        }, options);
+        indexAuthors = true;
+        if (!savedAuthors) authorIndex.save(authorIndexName(filename), stamp);
+        raiseNextId();
+        for (auto& shard : shards) shard->dirty.store(false);
+        return report;
+    }
+
+    // For a standby's copy, which replays another catalog's log instead of
+    // writing one of its own.
+    void disableMutationLog() {
+        logging = false;
+    }
+
+    // Applies one entry from another catalog's log. Entries are applied as
+    // they stand: IDs come from the log, and status changes are not conditional.
+    void applyMutation(const Mutation& m) {
+        if (m.id <= 0) return;
+        if (m.type == MutationType::Add) {
+            insert(new CatalogRecord(m.id, m.title, m.author, false), true);
+            raiseNextId();
+        }
+        else if (m.type == MutationType::Delete) {
+            deleteBookById(m.id);
+        }
+        else {
+            CatalogShard& shard = shardFor(m.id);
+            lock_guard<mutex> guard(shard.writeMutex);
+            CatalogRecord* r = shard.table.find(keyFor(m.id));
+            if (!r) return;
+            r->checkedOut.store(m.type == MutationType::CheckOut, memory_order_release);
+            ColumnStore::setStatus(r->column, m.type == MutationType::CheckOut);
+            statusChanges.fetch_add(1, memory_order_release);
+            recordChange(shard, m);
+        }
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& shard : shards) total += shard->count.load();
+        return total;
+    }
+
+    size_t shardCount() const {
+        return shards.size();
+    }
+
+    // Returns -1, without using up an ID, if the title or author cannot be stored.
+    int addBook(const string& title, const string& author) {
+        if (!isStorableField(title) || !isStorableField(author)) return -1;
+        int id = nextId.fetch_add(1);
+        insert(new CatalogRecord(id, title, author, false), true);
+        return id;
+    }
+
+    // Flips the book's status only if it is currently the opposite one. The
+    // compare-and-swap decides, so when two desks race for the same copy exactly
+    // one wins and the other gets Unchanged. The shard lock around it keeps the
+    // shard's log in the same order as its changes; records are only unlinked
+    // under that lock, so the record stays valid without an EpochGuard.
+    StatusChange updateBookStatus(int id, bool checkOut) {
+        if (id <= 0) return StatusChange::NotFound;
+        CatalogShard& shard = shardFor(id);
+        lock_guard<mutex> guard(shard.writeMutex);
+        CatalogRecord* r = shard.table.find(keyFor(id));
+        if (!r) return StatusChange::NotFound;
+        bool expected = !checkOut;
+        if (!r->checkedOut.compare_exchange_strong(expected, checkOut, memory_order_acq_rel)) {
+            return StatusChange::Unchanged;
+        }
+        ColumnStore::setStatus(r->column, checkOut);
+        statusChanges.fetch_add(1, memory_order_release);
+        recordChange(shard, makeMutation(checkOut ? MutationType::CheckOut : MutationType::CheckIn, id));
+        return StatusChange::Updated;
+    }
+
+    // Checks out or returns every book in ids, or none of them. The shards
+    // involved are locked in index order, every book is checked, and only then
+    // are they all flipped, so no other desk ever sees part of a batch. If a book
+    // is missing or already in the requested state, failedId names it.
+    StatusChange updateBooksStatus(vector<int> ids, bool checkOut, int& failedId) {
+        sort(ids.begin(), ids.end());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+
+        vector<size_t> involved;
+        for (int id : ids) involved.push_back(static_cast<size_t>(id) % shards.size());
+        sort(involved.begin(), involved.end());
+        involved.erase(unique(involved.begin(), involved.end()), involved.end());
+        vector<unique_lock<mutex>> locks;
+        for (size_t i : involved) locks.emplace_back(shards[i]->writeMutex);
+
+        vector<CatalogRecord*> records;
+        for (int id : ids) {
+            CatalogRecord* r = find(id);
+            if (!r || r->checkedOut.load(memory_order_acquire) == checkOut) {
+                failedId = id;
+                return r ? StatusChange::Unchanged : StatusChange::NotFound;
+            }
+            records.push_back(r);
+        }
+        for (CatalogRecord* r : records) {
+            r->checkedOut.store(checkOut, memory_order_release);
+            ColumnStore::setStatus(r->column, checkOut);
+            recordChange(shardFor(r->id), makeMutation(checkOut ? MutationType::CheckOut : MutationType::CheckIn, r->id));
+        }
+        statusChanges.fetch_add(1, memory_order_release);
+        return StatusChange::Updated;
+    }
+
+    bool deleteBookById(int id) {
+        if (id <= 0) return false;
+        CatalogShard& shard = shardFor(id);
+        lock_guard<mutex> guard(shard.writeMutex);
+        CatalogRecord* r = shard.table.unpublish(keyFor(id));
+        if (!r) return false;
+        shard.count--;
+        textIndex.remove(r->id, r->title, r->author);
+        prefixIndex.remove(r->id);
+        authorIndex.remove(r->id, r->author);
+        columns.remove(r->column);
+        bookChanges.fetch_add(1, memory_order_release);
+        EpochManager::instance().retire(r);
+        recordChange(shard, makeMutation(MutationType::Delete, id));
+        return true;
+    }
+
+    // Copies up to pageSize books with an ID after the cursor that pass the
+    // filter into page. Returns true if more books remain.
+    bool getPage(int cursor, size_t pageSize, vector<Book>& page, ListFilter filter = ListFilter::All) const {
+        EpochGuard guard;
+        page.clear();
+        bool more = false;
+        scanFrom(cursor, [&](const CatalogRecord& r) {
+            if (!matchesFilter(r.checkedOut.load(memory_order_acquire), filter)) return true;
+            if (page.size() == pageSize) {
+                more = true;
+                return false;
+            }
+            page.push_back(r.toBook());
+            return true;
+        });
+        return more;
+    }
+
+    // Copies up to pageSize of the author's books after the cursor that pass the
+    // filter into page, in ID order; ListFilter::Available gives the author's
+    // titles on the shelf. Returns true if more remain.
+    bool booksByAuthor(const string& author, ListFilter filter, int cursor, size_t pageSize,
+        vector<Book>& page) const {
+        vector<int> ids = authorIndex.find(author);
+        EpochGuard guard;
+        page.clear();
+        for (auto it = upper_bound(ids.begin(), ids.end(), cursor); it != ids.end(); ++it) {
+            CatalogRecord* r = find(*it);
+            if (!r || !matchesFilter(r->checkedOut.load(memory_order_acquire), filter)) continue;
+            if (page.size() == pageSize) return true;
+            page.push_back(r->toBook());
+        }
+        return false;
+    }
+
+    // Copies up to pageSize books that pass the filter into page in the given
+    // order, starting at position cursor of that order, and moves the cursor past
+    // the last book looked at. Returns true if more books remain.
+    bool sortedPage(SortOrder order, ListFilter filter, int& cursor, size_t pageSize, vector<Book>& page) const {
+        shared_ptr<const vector<int>> ids;
+        {
+            lock_guard<mutex> lock(sortMutex);
+            ids = sortedIdsLocked(order);
+        }
+        EpochGuard guard;
+        page.clear();
+        size_t at = static_cast<size_t>(max(cursor, 0));
+        for (; at < ids->size() && page.size() < pageSize; at++) {
+            CatalogRecord* r = find((*ids)[at]);
+            if (!r || !matchesFilter(r->checkedOut.load(memory_order_acquire), filter)) continue;
+            page.push_back(r->toBook());
+        }
+        cursor = static_cast<int>(at);
+        return at < ids->size();
+    }
+
+    // Copies up to pageSize books after the cursor that pass the filter into
+    // page, in ID order. Returns true if more remain.
+    bool filter(const FilterExpr& expr, int cursor, size_t pageSize, vector<Book>& page) const {
+        vector<int> ids;
+        bool more = columns.select(expr, cursor, pageSize, ids);
+        EpochGuard guard;
+        page.clear();
+        for (int id : ids) {
+            if (CatalogRecord* r = find(id)) page.push_back(r->toBook());
+        }
+        return more;
+    }
+
+    // Copies up to pageSize books after the cursor that match the query into
+    // page, in ID order. Returns true if more matches remain.
+    bool search(const SearchQuery& query, int cursor, size_t pageSize, vector<Book>& page) const {
+        vector<int> ids;
+        bool more = textIndex.search(query, cursor, pageSize, ids);
+        EpochGuard guard;
+        page.clear();
+        for (int id : ids) {
+            if (CatalogRecord* r = find(id)) page.push_back(r->toBook());
+        }
+        return more;
+    }
+
+    // Sorts books added since the last lookup into the autocomplete index, which
+    // otherwise happens on the next suggest call.
+    void prepareSuggestions() {
+        prefixIndex.flush();
+    }
+
+    // Up to count titles and authors starting with the prefix, alphabetically.
+    vector<Suggestion> suggest(string_view prefix, size_t count) {
+        vector<Suggestion> result;
+        EpochGuard guard;
+        for (const auto& match : prefixIndex.suggest(prefix, count)) {
+            if (CatalogRecord* r = find(match.first)) result.push_back({ r->toBook(), match.second });
+        }
+        return result;
+    }
+
+    // Writes the catalog back to its file, and the queued changes to its log in
+    // the order they were made, if any shard changed since the last save. Every
+    // shard is copied together with its queued changes while all of their locks
+    // are held, as for a background save, so the file is one point in time: a
+    // batch spanning shards is all in it or not at all, every logged change is in
+    // it and nothing in it is missing from the log.
+    bool persist() {
+        return save(true);
+    }
+
+    // For callers that already hold an Exclusive FileLock on the catalog file.
+    bool persistWhileLocked() {
+        return save(false);
+    }
+
+    // The most recent background save, if ok is set.
+    SnapshotReport lastBackgroundSave() const {
+        lock_guard<mutex> guard(reportMutex);
+        return lastSnapshot;
+    }
+
+#ifndef _WIN32
+    // Starts saving in the background, for catalogs large enough that persist()
+    // would hold up the server. The process forks while every shard is locked,
+    // so the child inherits a point-in-time image and writes it to
+    // "<file>.snapshot" while this process carries on; the kernel copies any page
+    // either side changes afterwards. Other threads keep running and may hold the
+    // allocator's or a stream's lock at the moment of the fork, so the child only
+    // reads memory and makes system calls: its name and write buffer are set up
+    // here first. Returns false if nothing changed or a save is already running.
+    bool startBackgroundSave() {
+        lock_guard<mutex> guard(persistMutex);
+        if (saverPid > 0) return false;
+        bool anyDirty = false;
+        for (auto& shard : shards) {
+            if (shard->dirty.exchange(false, memory_order_acq_rel)) anyDirty = true;
+        }
+        if (!anyDirty) return false;
+
+        int fds[2];
+        if (pipe(fds) != 0) {
+            shards[0]->dirty.store(true);
+            return false;
+        }
+        saverLog.assign(shards.size(), {});
+        const string image = imageName();
+        vector<char> buffer(SAVE_BLOCK_SIZE);
+        pid_t pid;
+        {
+            vector<unique_lock<mutex>> locks;
+            for (auto& shard : shards) locks.emplace_back(shard->writeMutex);
+            for (size_t i = 0; i < shards.size(); i++) saverLog[i].swap(shards[i]->pending);
+            pid = fork();
+            if (pid == 0) {
+                close(fds[0]);
+                writeImageAndExit(fds[1], image.c_str(), buffer.data(), buffer.size());
+            }
+        }
+        close(fds[1]);
+        if (pid < 0) {
+            close(fds[0]);
+            requeue(saverLog);
+            return false;
+        }
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        saverPid = pid;
+        saverPipe = fds[0];
+        return true;
+    }
+
+    // Collects a background save that has finished (or waits for it). If the
+    // child succeeded, its image replaces the file and the changes it covers go
+    // to the log; otherwise they are queued again for the next save. Returns
+    // true if a save finished successfully.
+    bool finishBackgroundSave(bool wait = false) {
+        lock_guard<mutex> guard(persistMutex);
+        return reapSaver(wait);
+    }
+#endif
+
+private:
+#ifndef _WIN32
+    string imageName() const {
+        return filename + ".snapshot";
+    }
+
+    // Collects rows in a buffer set up before the fork and hands each full one to
+    // write(2). Nothing here allocates or takes a lock.
+    struct ImageWriter {
+        int fd;
+        char* buffer;
+        size_t capacity;
+        size_t used = 0;
+        bool ok = true;
+
+        void flush() {
+            for (size_t done = 0; ok && done < used;) {
+                ssize_t n = ::write(fd, buffer + done, used - done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) ok = false;
+                else done += static_cast<size_t>(n);
+            }
+            used = 0;
+        }
+
+        void append(const char* data, size_t size) {
+            while (size > 0) {
+                if (used == capacity) flush();
+                size_t n = min(size, capacity - used);
+                memcpy(buffer + used, data, n);
+                used += n;
+                data += n;
+                size -= n;
+            }
+        }
+    };
+
+    // Runs in the forked child, which has only this thread and must not touch
+    // anything another thread could have held at the fork: reads the inherited
+    // records without locks, writes them out through ImageWriter and reports back
+    // through the pipe. The author index is left for the next lookup to rebuild.
+    [[noreturn]] void writeImageAndExit(int resultFd, const char* image, char* buffer, size_t capacity) {
+        auto started = chrono::steady_clock::now();
+        SnapshotReport report;
+        ImageWriter out{ open(image, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666), buffer, capacity };
+        out.ok = out.fd >= 0;
+        scanFrom(0, [&](const CatalogRecord& r) {
+            LibraryItem::serializeRow(out, r.id, r.title, r.author, r.checkedOut.load(memory_order_acquire));
+            out.append("\n", 1);
+            report.books++;
+            return true;
+        });
+        for (const auto& line : rejectedLines) {
+            out.append(line.data(), line.size());
+            out.append("\n", 1);
+        }
+        out.flush();
+        report.ok = out.ok && close(out.fd) == 0;
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        report.copyOnWriteBytes = privateDirtyBytes();
+        ssize_t sent = write(resultFd, &report, sizeof(report));
+        _exit(report.ok && sent == static_cast<ssize_t>(sizeof(report)) ? 0 : 1);
+    }
+
+    // Callers hold persistMutex.
+    bool reapSaver(bool wait) {
+        if (saverPid <= 0) return false;
+        int status = 0;
+        pid_t done;
+        while ((done = waitpid(saverPid, &status, wait ? 0 : WNOHANG)) < 0 && errno == EINTR) {
+        }
+        if (done == 0) return false;
+
+        SnapshotReport report;
+        ssize_t received = read(saverPipe, &report, sizeof(report));
+        close(saverPipe);
+        saverPid = -1;
+        saverPipe = -1;
+
+        bool ok = done > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0
+            && received == static_cast<ssize_t>(sizeof(report)) && report.ok;
+        if (ok) {
+            FileLock lock(filename, FileLock::Exclusive);
+            error_code ec;
+            filesystem::rename(imageName(), filename, ec);
+            if (ec) {
+                cerr << "\nError: Could not replace " << filename << ": " << ec.message() << endl;
+                ok = false;
+            }
+            else {
+                filesystem::remove(authorIndexName(filename), ec);
+                vector<Mutation> batch = inChangeOrder(saverLog);
+                appendMutations(filename, batch);
+            }
+        }
+
+        if (!ok) {
+            cerr << "\nError: Background save of " << filename << " failed; it will be retried." << endl;
+            requeue(saverLog);
+            return false;
+        }
+        saverLog.clear();
+        lock_guard<mutex> reporting(reportMutex);
+        lastSnapshot = report;
+        return true;
+    }
+#endif
+
+    bool save(bool takeFileLock) {
+        lock_guard<mutex> guard(persistMutex);
+#ifndef _WIN32
+        // A background save's changes must reach the log before anything newer.
+        reapSaver(true);
+#endif
+        bool anyDirty = false;
+        for (auto& shard : shards) {
+            if (shard->dirty.exchange(false, memory_order_acq_rel)) anyDirty = true;
+        }
+        if (!anyDirty) return true;
+
+        // Each shard's copy comes out in ID order, and they are merged below.
+        vector<vector<Book>> parts(shards.size());
+        vector<vector<Mutation>> logged(shards.size());
+        {
+            vector<unique_lock<mutex>> locks;
+            for (auto& shard : shards) locks.emplace_back(shard->writeMutex);
+            for (size_t i = 0; i < shards.size(); i++) {
+                shards[i]->table.forEach([&](const CatalogRecord& r) { parts[i].push_back(r.toBook()); });
+                logged[i].swap(shards[i]->pending);
+            }
+        }
+
+        vector<Book> snapshot;
+        size_t total = 0;
+        for (const auto& part : parts) total += part.size();
+        snapshot.reserve(total);
+        vector<size_t> next(shards.size(), 0);
+        while (snapshot.size() < total) {
+            size_t lowest = shards.size();
+            for (size_t i = 0; i < shards.size(); i++) {
+                if (next[i] == parts[i].size()) continue;
+                if (lowest == shards.size() || parts[i][next[i]].getId() < parts[lowest][next[lowest]].getId()) lowest = i;
+            }
+            snapshot.push_back(std::move(parts[lowest][next[lowest]++]));
+        }
+
+        unique_ptr<FileLock> lock;
+        if (takeFileLock) lock = make_unique<FileLock>(filename, FileLock::Exclusive);
+        if (!overwriteDatabase(filename, snapshot, rejectedLines)) {
+            requeue(logged);
+            return false;
+        }
+        writeAuthorIndex(filename, snapshot);
+
+        vector<Mutation> batch = inChangeOrder(logged);
+        return appendMutations(filename, batch);
+    }
+};
+
+/* ------------------------
+ * Catalog Server
+ * ------------------------
+ */
+// Terminals and the catalog server exchange length-prefixed binary frames.
+// Integers are little-endian; strings are a u16 length followed by the bytes.
+//
+//   frame    = u32 body length, body
+//   body     = u16 op count, one request (or reply) per op
+//   request  = u8 opcode, i32 book ID, u32 count, title, author
+//   reply    = u8 status, u8 flags, i32 book ID, u32 row count, rows
+//   row      = i32 book ID, u8 row flags, title, author
+//
+// One request frame can carry many operations; the reply frame answers them in
+// the same order. The decoder hands out string_views into the receive buffer,
+// so nothing in a request is copied until the catalog stores it.
+const string DEFAULT_SOCKET = "library.sock";
+const string DEFAULT_STANDBY_FILE = "library-standby.csv";
+
+enum class Opcode : uint8_t {
+    AddBook = 1,    // title, author -> ID of the new book
+    GetPage = 2,    // ID = cursor, count = page size -> rows
+    CheckOut = 3,   // ID
+    CheckIn = 4,    // ID
+    DeleteBook = 5, // ID
+    CheckOutAll = 6,// count IDs packed as i32s in the title field -> ID that failed
+    CheckInAll = 7, // same as CheckOutAll
+    Search = 8,     // title = query, ID = cursor, count = page size -> rows
+    Suggest = 9,    // title = prefix, count = how many -> rows, each flagged
+                    // ROW_AUTHOR_MATCH if its author matched rather than its title
+    FuzzySearch = 10,// same as Search, also accepting misspelled words
+    AuthorBooks = 11,// author, ID = cursor, count = page size, title "available"
+                     // to leave out checked-out books -> rows
+    Filter = 12,     // title = filter expression, ID = cursor, count = page size -> rows
+    SortedPage = 13  // title = "title", "author" or "status", author = "available",
+                     // "checked-out" or empty, ID = position in that order, count =
+                     // page size -> rows, with the ID set to the position after them
+};
+
+enum class ReplyStatus : uint8_t {
+    Ok = 0,
+    NotFound = 1,
+    BadRequest = 2,
+    Conflict = 3    // check-out/check-in: the book is already in that state
+};
+
+const uint8_t REPLY_MORE = 1; // GetPage flag: more books remain after this page
+
+const uint8_t ROW_CHECKED_OUT = 1;
+const uint8_t ROW_AUTHOR_MATCH = 2; // Suggest: the author is what matched
+
+const size_t FRAME_HEADER_SIZE = 4;
+const size_t MAX_FRAME_SIZE = 16 << 20;
+const uint32_t MAX_PAGE_SIZE = 10000;
+const uint32_t MAX_BATCH_IDS = 1000;
+
+struct RequestOp {
+    Opcode opcode;
+    int id;
+    uint32_t count;
+    string_view title;
+    string_view author;
+};
+
+struct ReplyOp {
+    ReplyStatus status = ReplyStatus::BadRequest;
+    bool more = false;
+    int id = 0;
+    vector<Book> rows;
+    vector<bool> authorMatches; // per row, ROW_AUTHOR_MATCH
+};
+
+const char* describeReplyStatus(ReplyStatus status) {
+    switch (status) {
+    case ReplyStatus::Ok: return "OK";
+    case ReplyStatus::NotFound: return "Book not found.";
+    case ReplyStatus::BadRequest: return "Bad request.";
+    case ReplyStatus::Conflict: return "Book is already in that state.";
+    }
+    return "Unknown reply.";
+}
+
+// Parses book IDs separated by commas and/or spaces, such as "12, 15 19".
+bool parseIdList(string_view text, vector<int>& ids) {
+    ids.clear();
+    size_t i = 0;
+    while (i < text.size()) {
+        if (text[i] == ',' || isspace(static_cast<unsigned char>(text[i]))) {
+            i++;
+            continue;
+        }
+        size_t end = min(text.find_first_of(", \t\r\n", i), text.size());
+        int id = 0;
+        if (!parseInt(text.substr(i, end - i), id)) return false;
+        ids.push_back(id);
+        i = end;
+    }
+    return !ids.empty();
+}
+
+void putU8(string& out, uint8_t value) {
+    out += static_cast<char>(value);
+}
+
+void putU16(string& out, uint16_t value) {
+    char bytes[2] = { static_cast<char>(value), static_cast<char>(value >> 8) };
+    out.append(bytes, 2);
+}
+
+void putU32(string& out, uint32_t value) {
+    char bytes[4] = { static_cast<char>(value), static_cast<char>(value >> 8),
+        static_cast<char>(value >> 16), static_cast<char>(value >> 24) };
+    out.append(bytes, 4);
+}
+
+void putI32(string& out, int value) {
+    putU32(out, static_cast<uint32_t>(value));
+}
+
+// Strings longer than 65535 bytes are cut off at that length.
+void putString(string& out, string_view text) {
+    size_t length = min(text.size(), size_t(0xFFFF));
+    putU16(out, static_cast<uint16_t>(length));
+    out.append(text.data(), length);
+}
+
+// Reads fields from a frame body in order. A read past the end marks the reader
+// as failed and returns zero instead of touching memory outside the body.
+class WireReader {
+private:
+    string_view data;
+    bool failed = false;
+
+    const unsigned char* take(size_t size) {
+        if (failed || data.size() < size) {
+            failed = true;
+            return nullptr;
+        }
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data());
+        data.remove_prefix(size);
+        return bytes;
+    }
+
+public:
+    explicit WireReader(string_view data) : data(data) {
+    }
+
+    bool ok() const { return !failed; }
+    bool atEnd() const { return data.empty(); }
+
+    uint8_t u8() {
+        const unsigned char* b = take(1);
+        return b ? b[0] : 0;
+    }
+
+    uint16_t u16() {
+        const unsigned char* b = take(2);
+        return b ? static_cast<uint16_t>(b[0] | (b[1] << 8)) : 0;
+    }
+
+    uint32_t u32() {
+        const unsigned char* b = take(4);
+        return b ? (uint32_t(b[0]) | (uint32_t(b[1]) << 8) | (uint32_t(b[2]) << 16) | (uint32_t(b[3]) << 24)) : 0;
+    }
+
+    int i32() { return static_cast<int>(u32()); }
+
+    string_view str() {
+        uint16_t length = u16();
+        const unsigned char* b = take(length);
+        return b ? string_view(reinterpret_cast<const char*>(b), length) : string_view();
+    }
+};
+
+// Starts a frame in out and returns its position, for endFrame to fill in the
+// body length and op count once everything has been appended.
+size_t beginFrame(string& out) {
+    size_t start = out.size();
+    putU32(out, 0);
+    putU16(out, 0);
+    return start;
+}
+
+void endFrame(string& out, size_t start, uint16_t opCount) {
+    string header;
+    putU32(header, static_cast<uint32_t>(out.size() - start - FRAME_HEADER_SIZE));
+    putU16(header, opCount);
+    out.replace(start, header.size(), header);
+}
+
+// Size of the complete frame at the front of buffer, 0 if more bytes are still
+// needed, or SIZE_MAX if the frame claims to be larger than MAX_FRAME_SIZE.
+size_t completeFrameSize(string_view buffer) {
+    if (buffer.size() < FRAME_HEADER_SIZE) return 0;
+    size_t body = WireReader(buffer).u32();
+    if (body > MAX_FRAME_SIZE) return SIZE_MAX;
+    return buffer.size() >= FRAME_HEADER_SIZE + body ? FRAME_HEADER_SIZE + body : 0;
+}
+
+void putRequest(string& out, Opcode opcode, int id, uint32_t count, string_view title, string_view author) {
+    putU8(out, static_cast<uint8_t>(opcode));
+    putI32(out, id);
+    putU32(out, count);
+    putString(out, title);
+    putString(out, author);
+}
+
+void putRow(string& out, const Book& b, uint8_t flags = 0) {
+    putI32(out, b.getId());
+    putU8(out, flags | (b.getCheckedOut() ? ROW_CHECKED_OUT : 0));
+    putString(out, b.getTitle());
+    putString(out, b.getAuthor());
+}
+
+// Runs one decoded operation against the catalog and appends its reply.
+void executeOp(Catalog& catalog, const RequestOp& op, string& out, vector<Book>& page) {
+    ReplyStatus status = ReplyStatus::Ok;
+    uint8_t flags = 0;
+    int id = op.id;
+    vector<bool> authorMatches;
+    page.clear();
+
+    switch (op.opcode) {
+    case Opcode::AddBook: {
+        int added = catalog.addBook(string(op.title), string(op.author));
+        if (added < 0) status = ReplyStatus::BadRequest;
+        else id = added;
+        break;
+    }
+    case Opcode::GetPage:
+        if (op.count > MAX_PAGE_SIZE) status = ReplyStatus::BadRequest;
+        else if (catalog.getPage(op.id, op.count, page)) flags |= REPLY_MORE;
+        break;
+    case Opcode::Search:
+    case Opcode::FuzzySearch: {
+        SearchQuery query = parseSearchQuery(op.title);
+        query.fuzzy = op.opcode == Opcode::FuzzySearch;
+        if (op.count > MAX_PAGE_SIZE) status = ReplyStatus::BadRequest;
+        else if (catalog.search(query, op.id, op.count, page)) flags |= REPLY_MORE;
+        break;
+    }
+    case Opcode::Filter: {
+        FilterExpr expr;
+        string error;
+        if (op.count > MAX_PAGE_SIZE || !parseFilter(op.title, expr, error)) status = ReplyStatus::BadRequest;
+        else if (catalog.filter(expr, op.id, op.count, page)) flags |= REPLY_MORE;
+        break;
+    }
+    case Opcode::SortedPage: {
+        SortOrder order = SortOrder::Title;
+        ListFilter filter = ListFilter::All;
+        if (op.author == "available") filter = ListFilter::Available;
+        else if (op.author == "checked-out") filter = ListFilter::CheckedOut;
+        if (op.count > MAX_PAGE_SIZE || !parseSortOrder(op.title, order)
+            || (!op.author.empty() && filter == ListFilter::All)) status = ReplyStatus::BadRequest;
+        else if (catalog.sortedPage(order, filter, id, op.count, page)) flags |= REPLY_MORE;
+        break;
+    }
+    case Opcode::AuthorBooks: {
+        ListFilter filter = op.title == "available" ? ListFilter::Available : ListFilter::All;
+        if (op.count > MAX_PAGE_SIZE || (!op.title.empty() && filter == ListFilter::All)) status = ReplyStatus::BadRequest;
+        else if (catalog.booksByAuthor(string(op.author), filter, op.id, op.count, page)) flags |= REPLY_MORE;
+        break;
+    }
+    case Opcode::Suggest:
+        if (op.count > MAX_PAGE_SIZE) status = ReplyStatus::BadRequest;
+        else {
+            for (auto& s : catalog.suggest(op.title, op.count)) {
+                page.push_back(std::move(s.book));
+                authorMatches.push_back(s.author);
+            }
+        }
+        break;
+    case Opcode::CheckOut:
+    case Opcode::CheckIn:
+        switch (catalog.updateBookStatus(op.id, op.opcode == Opcode::CheckOut)) {
+        case StatusChange::Updated: break;
+        case StatusChange::NotFound: status = ReplyStatus::NotFound; break;
+        case StatusChange::Unchanged: status = ReplyStatus::Conflict; break;
+        }
+        break;
+    case Opcode::DeleteBook:
+        if (!catalog.deleteBookById(op.id)) status = ReplyStatus::NotFound;
+        break;
+    case Opcode::CheckOutAll:
+    case Opcode::CheckInAll: {
+        if (op.count == 0 || op.count > MAX_BATCH_IDS || op.title.size() != op.count * 4) {
+            status = ReplyStatus::BadRequest;
+            break;
+        }
+        vector<int> ids;
+        WireReader packed(op.title);
+        for (uint32_t i = 0; i < op.count; i++) ids.push_back(packed.i32());
+        switch (catalog.updateBooksStatus(std::move(ids), op.opcode == Opcode::CheckOutAll, id)) {
+        case StatusChange::Updated: break;
+        case StatusChange::NotFound: status = ReplyStatus::NotFound; break;
+        case StatusChange::Unchanged: status = ReplyStatus::Conflict; break;
+        }
+        break;
+    }
+    default:
+        status = ReplyStatus::BadRequest;
+        break;
+    }
+
+    putU8(out, static_cast<uint8_t>(status));
+    putU8(out, flags);
+    putI32(out, id);
+    putU32(out, static_cast<uint32_t>(page.size()));
+    for (size_t i = 0; i < page.size(); i++) {
+        putRow(out, page[i], i < authorMatches.size() && authorMatches[i] ? ROW_AUTHOR_MATCH : 0);
+    }
+}
+
+// Decodes one request frame body, runs every operation in it and appends the
+// reply frame to out. Nothing runs unless the whole frame decodes; a malformed
+// frame returns false and the connection should be dropped. Changes are not
+// saved here; the caller persists the catalog before sending the replies.
+bool handleFrame(Catalog& catalog, string_view body, string& out) {
+    WireReader in(body);
+    uint16_t opCount = in.u16();
+
+    vector<RequestOp> ops;
+    ops.reserve(opCount);
+    for (uint16_t i = 0; i < opCount && in.ok(); i++) {
+        RequestOp op;
+        op.opcode = static_cast<Opcode>(in.u8());
+        op.id = in.i32();
+        op.count = in.u32();
+        op.title = in.str();
+        op.author = in.str();
+        ops.push_back(op);
+    }
+    if (!in.ok() || !in.atEnd()) return false;
+
+    size_t frame = beginFrame(out);
+    vector<Book> page;
+    for (const auto& op : ops) executeOp(catalog, op, out, page);
+    endFrame(out, frame, opCount);
+    return true;
+}
+
+/* ------------------------
+ * HTTP Endpoint
+ * ------------------------
+ */
+// A small HTTP/1.1 front end for the self-checkout kiosks, served by the same
+// event loop as the binary protocol. Connections stay open between requests
+// (keep-alive) and pipelined requests are answered in order.
+//
+//   GET    /books?after=<id>&limit=<n>  one page of books, plus the next cursor
+//   GET    /books?author=..&available=1 one author's books (available=1: on the shelf)
+//   GET    /books?filter=<expression>   books passing a filter, e.g. status=available
+//   POST   /books?title=..&author=..    add a book (form encoded body also works)
+//   POST   /books/<id>/checkout         check a book out
+//   POST   /books/<id>/checkin          check a book in
+//   DELETE /books/<id>                  delete a book
+//   GET    /suggest?q=<prefix>&k=<n>    titles and authors starting with prefix
+//   GET    /stats                       worker queue depths and steal counts
+const size_t MAX_HTTP_HEADER_SIZE = 64 << 10;
+const size_t MAX_HTTP_BODY_SIZE = 1 << 20;
+const uint32_t DEFAULT_HTTP_PAGE_SIZE = 50;
+
+// Writes JSON straight into an output buffer as values are added, keeping track
+// of where commas go, so a response never exists as an intermediate object.
+class JsonWriter {
+private:
+    string& out;
+    vector<bool> needsComma;
+
+    void separate() {
+        if (!needsComma.empty()) {
+            if (needsComma.back()) out += ',';
+            needsComma.back() = true;
+        }
+    }
+
+public:
+    explicit JsonWriter(string& out) : out(out) {
+    }
+
+    JsonWriter& beginObject() { separate(); out += '{'; needsComma.push_back(false); return *this; }
+    JsonWriter& endObject() { out += '}'; needsComma.pop_back(); return *this; }
+    JsonWriter& beginArray() { separate(); out += '['; needsComma.push_back(false); return *this; }
+    JsonWriter& endArray() { out += ']'; needsComma.pop_back(); return *this; }
+
+    // The value that follows a key must not add another comma.
+    JsonWriter& key(string_view name) {
+        separate();
+        appendString(name);
+        out += ':';
+        needsComma.back() = false;
+        return *this;
+    }
+
+    JsonWriter& value(string_view text) {
+        separate();
+        appendString(text);
+        return *this;
+    }
+
+    JsonWriter& value(int number) {
+        separate();
+        char digits[16];
+        auto result = to_chars(digits, digits + sizeof(digits), number);
+        out.append(digits, result.ptr - digits);
+        return *this;
+    }
+
+    JsonWriter& value(bool flag) {
+        separate();
+        out += flag ? "true" : "false";
+        return *this;
+    }
+
+    JsonWriter& null() {
+        separate();
+        out += "null";
+        return *this;
+    }
+
+private:
+    void appendString(string_view text) {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        for (char ch : text) {
+            unsigned char c = static_cast<unsigned char>(ch);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += ch;
+            }
+            else if (c < 0x20) {
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 15];
+            }
+            else {
+                out += ch;
+            }
+        }
+        out += '"';
+    }
+};
+
+void writeBookJson(JsonWriter& json, const Book& b) {
+    json.beginObject()
+        .key("id").value(b.getId())
+        .key("title").value(b.getTitle())
+        .key("author").value(b.getAuthor())
+        .key("checkedOut").value(b.getCheckedOut())
+        .endObject();
+}
+
+struct HttpRequest {
+    string_view method;
+    string_view path;
+    string_view query;
+    string_view body;
+    bool keepAlive = true;
+};
+
+enum class HttpParse { Incomplete, Complete, Bad };
+
+bool equalsIgnoreCase(string_view a, string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) return false;
+    }
+    return true;
+}
+
+// Parses the request at the front of buffer. On Complete, request points into
+// buffer and size is the number of bytes the request used.
+HttpParse parseHttpRequest(string_view buffer, HttpRequest& request, size_t& size) {
+    size_t headerEnd = buffer.find("\r\n\r\n");
+    if (headerEnd == string_view::npos) {
+        return buffer.size() > MAX_HTTP_HEADER_SIZE ? HttpParse::Bad : HttpParse::Incomplete;
+    }
+
+    string_view head = buffer.substr(0, headerEnd);
+    size_t lineEnd = head.find("\r\n");
+    string_view requestLine = head.substr(0, lineEnd);
+    size_t space1 = requestLine.find(' ');
+    size_t space2 = requestLine.rfind(' ');
+    if (space1 == string_view::npos || space2 == space1) return HttpParse::Bad;
+
+    request = HttpRequest();
+    request.method = requestLine.substr(0, space1);
+    string_view target = requestLine.substr(space1 + 1, space2 - space1 - 1);
+    string_view version = requestLine.substr(space2 + 1);
+    size_t question = target.find('?');
+    request.path = target.substr(0, question);
+    request.query = (question == string_view::npos) ? string_view() : target.substr(question + 1);
+    request.keepAlive = (version == "HTTP/1.1");
+
+    size_t contentLength = 0;
+    string_view headers = (lineEnd == string_view::npos) ? string_view() : head.substr(lineEnd + 2);
+    while (!headers.empty()) {
+        size_t end = headers.find("\r\n");
+        string_view header = headers.substr(0, end);
+        headers = (end == string_view::npos) ? string_view() : headers.substr(end + 2);
+
+        size_t colon = header.find(':');
+        if (colon == string_view::npos) continue;
+        string_view name = header.substr(0, colon);
+        string_view value = header.substr(colon + 1);
+        while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+
+        if (equalsIgnoreCase(name, "Content-Length")) {
+            int length = 0;
+            if (!parseInt(value, length) || length < 0 || size_t(length) > MAX_HTTP_BODY_SIZE) return HttpParse::Bad;
+            contentLength = static_cast<size_t>(length);
+        }
+        else if (equalsIgnoreCase(name, "Connection")) {
+            if (equalsIgnoreCase(value, "close")) request.keepAlive = false;
+            else if (equalsIgnoreCase(value, "keep-alive")) request.keepAlive = true;
+        }
+    }
+
+    size_t bodyStart = headerEnd + 4;
+    if (buffer.size() < bodyStart + contentLength) return HttpParse::Incomplete;
+    request.body = buffer.substr(bodyStart, contentLength);
+    size = bodyStart + contentLength;
+    return HttpParse::Complete;
+}
+
+// Finds name in a query string or form body and percent-decodes its value.
+bool getFormValue(string_view form, string_view name, string& value) {
+    while (!form.empty()) {
+        size_t amp = form.find('&');
+        string_view pair = form.substr(0, amp);
+        form = (amp == string_view::npos) ? string_view() : form.substr(amp + 1);
+
+        size_t equals = pair.find('=');
+        if (pair.substr(0, equals) != name) continue;
+        string_view raw = (equals == string_view::npos) ? string_view() : pair.substr(equals + 1);
+
+        value.clear();
+        for (size_t i = 0; i < raw.size(); i++) {
+            if (raw[i] == '+') {
+                value += ' ';
+            }
+            else if (raw[i] == '%' && i + 2 < raw.size()) {
+                int code = 0;
+                auto result = from_chars(raw.data() + i + 1, raw.data() + i + 3, code, 16);
+                if (result.ptr != raw.data() + i + 3) return false;
+                value += static_cast<char>(code);
+                i += 2;
+            }
+            else {
+                value += raw[i];
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+const char* httpReason(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    }
+    return "Error";
+}
+
+// Writes the status line and headers for a JSON body that has already been
+// appended to out at bodyStart.
+void finishHttpResponse(string& out, size_t bodyStart, int status, bool keepAlive) {
+    string header = "HTTP/1.1 ";
+    header += to_string(status);
+    header += ' ';
+    header += httpReason(status);
+    header += "\r\nContent-Type: application/json\r\nContent-Length: ";
+    header += to_string(out.size() - bodyStart);
+    header += keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+    out.insert(bodyStart, header);
+}
+
+void writeHttpError(string& out, size_t bodyStart, int status, string_view message, bool keepAlive) {
+    out.resize(bodyStart);
+    JsonWriter json(out);
+    json.beginObject().key("error").value(message).endObject();
+    finishHttpResponse(out, bodyStart, status, keepAlive);
+}
+
+// Runs one HTTP request against the catalog and appends the response to out.
+// Like handleFrame, changes are saved by the caller before anything is sent.
+// pool, when given, is reported on by GET /stats.
+void handleHttpRequest(Catalog& catalog, const HttpRequest& request, string& out,
+    const ThreadPool* pool = nullptr) {
+    size_t bodyStart = out.size();
+    JsonWriter json(out);
+    bool keepAlive = request.keepAlive;
+    string_view path = request.path;
+
+    if (path == "/stats" && request.method == "GET") {
+        json.beginObject().key("books").value(static_cast<int>(catalog.size()));
+        json.key("workers").beginArray();
+        if (pool) {
+            for (const auto& w : pool->stats()) {
+                json.beginObject()
+                    .key("queued").value(static_cast<int>(w.queued))
+                    .key("executed").value(static_cast<int>(w.executed))
+                    .key("steals").value(static_cast<int>(w.steals))
+                    .endObject();
+            }
+        }
+        json.endArray().key("lastBackgroundSave");
+        Catalog::SnapshotReport snapshot = catalog.lastBackgroundSave();
+        if (snapshot.ok) {
+            json.beginObject()
+                .key("books").value(static_cast<int>(snapshot.books))
+                .key("ms").value(static_cast<int>(snapshot.seconds * 1000))
+                .key("copyOnWriteKB").value(static_cast<int>(snapshot.copyOnWriteBytes / 1024))
+                .endObject();
+        }
+        else {
+            json.null();
+        }
+        json.endObject();
+        finishHttpResponse(out, bodyStart, 200, keepAlive);
+        return;
+    }
+
+    if (path == "/suggest" && request.method == "GET") {
+        string prefix, text;
+        int count = DEFAULT_SUGGESTIONS;
+        if (!getFormValue(request.query, "q", prefix)
+            || (getFormValue(request.query, "k", text) && (!parseInt(text, count) || count < 0
+                || uint32_t(count) > MAX_PAGE_SIZE))) {
+            writeHttpError(out, bodyStart, 400, "Bad suggest request.", keepAlive);
+            return;
+        }
+        json.beginObject().key("suggestions").beginArray();
+        for (const auto& s : catalog.suggest(prefix, static_cast<size_t>(count))) {
+            json.beginObject()
+                .key("text").value(s.text())
+                .key("field").value(string_view(s.author ? "author" : "title"))
+                .key("id").value(s.book.getId())
+                .endObject();
+        }
+        json.endArray().endObject();
+        finishHttpResponse(out, bodyStart, 200, keepAlive);
+        return;
+    }
+
+    if (path == "/books") {
+        if (request.method == "GET") {
+            string text;
+            int after = 0;
+            int limit = DEFAULT_HTTP_PAGE_SIZE;
+            if ((getFormValue(request.query, "after", text) && !parseInt(text, after))
+                || (getFormValue(request.query, "limit", text) && (!parseInt(text, limit) || limit < 0
+                    || uint32_t(limit) > MAX_PAGE_SIZE))) {
+                writeHttpError(out, bodyStart, 400, "Bad page request.", keepAlive);
+                return;
+            }
+
+            // ?q=words searches titles and authors instead of listing everything;
+            // adding fuzzy=1 also accepts misspelled words. ?author=name lists one
+            // author's books, and only those on the shelf with available=1.
+            // ?filter=expression lists the books passing a filter. ?sort=title,
+            // author or status lists everything in that order; there "after" and
+            // "next" are positions in the order rather than IDs.
+            vector<Book> page;
+            bool more;
+            bool sorted = false;
+            int next = after;
+            string author;
+            if (getFormValue(request.query, "sort", text)) {
+                SortOrder order = SortOrder::Title;
+                if (!parseSortOrder(text, order)) {
+                    writeHttpError(out, bodyStart, 400, "Sort by title, author or status.", keepAlive);
+                    return;
+                }
+                ListFilter filter = getFormValue(request.query, "available", text) && text == "1"
+                    ? ListFilter::Available : ListFilter::All;
+                sorted = true;
+                more = catalog.sortedPage(order, filter, next, static_cast<size_t>(limit), page);
+            }
+            else if (getFormValue(request.query, "filter", text)) {
+                FilterExpr expr;
+                string error;
+                if (!parseFilter(text, expr, error)) {
+                    writeHttpError(out, bodyStart, 400, "Bad filter: " + error, keepAlive);
+                    return;
+                }
+                more = catalog.filter(expr, after, static_cast<size_t>(limit), page);
+            }
+            else if (getFormValue(request.query, "author", author)) {
+                ListFilter filter = getFormValue(request.query, "available", text) && text == "1"
+                    ? ListFilter::Available : ListFilter::All;
+                more = catalog.booksByAuthor(author, filter, after, static_cast<size_t>(limit), page);
+            }
+            else if (getFormValue(request.query, "q", text)) {
+                SearchQuery query = parseSearchQuery(text);
+                query.fuzzy = getFormValue(request.query, "fuzzy", text) && text == "1";
+                more = catalog.search(query, after, static_cast<size_t>(limit), page);
+            }
+            else {
+                more = catalog.getPage(after, static_cast<size_t>(limit), page);
+            }
+            json.beginObject().key("books").beginArray();
+            for (const auto& b : page) writeBookJson(json, b);
+            json.endArray().key("next");
+            if (more && !page.empty()) json.value(sorted ? next : page.back().getId());
+            else json.null();
+            json.endObject();
+            finishHttpResponse(out, bodyStart, 200, keepAlive);
+            return;
+        }
+        if (request.method == "POST") {
+            string title, author;
+            bool found = (getFormValue(request.query, "title", title) || getFormValue(request.body, "title", title))
+                && (getFormValue(request.query, "author", author) || getFormValue(request.body, "author", author));
+            if (!found || title.empty()) {
+                writeHttpError(out, bodyStart, 400, "Both title and author are required.", keepAlive);
+                return;
+            }
+            int id = catalog.addBook(title, author);
+            if (id < 0) {
+                writeHttpError(out, bodyStart, 400, BAD_FIELD_MESSAGE, keepAlive);
+                return;
+            }
+            json.beginObject().key("id").value(id).endObject();
+            finishHttpResponse(out, bodyStart, 201, keepAlive);
+            return;
+        }
+        writeHttpError(out, bodyStart, 405, "Use GET or POST.", keepAlive);
+        return;
+    }
+
+    // POST /books/checkout or /books/checkin with ids=1,2,3: all or nothing.
+    if (path == "/books/checkout" || path == "/books/checkin") {
+        if (request.method != "POST") {
+            writeHttpError(out, bodyStart, 405, "Use POST.", keepAlive);
+            return;
+        }
+        string text;
+        vector<int> ids;
+        if (!(getFormValue(request.query, "ids", text) || getFormValue(request.body, "ids", text))
+            || !parseIdList(text, ids) || ids.size() > MAX_BATCH_IDS) {
+            writeHttpError(out, bodyStart, 400, "ids must list between 1 and 1000 book IDs.", keepAlive);
+            return;
+        }
+        int failedId = 0;
+        StatusChange change = catalog.updateBooksStatus(ids, path == "/books/checkout", failedId);
+        if (change != StatusChange::Updated) {
+            string message = "Book " + to_string(failedId)
+                + (change == StatusChange::NotFound ? " not found." : " is already in that state.")
+                + " No books were updated.";
+            writeHttpError(out, bodyStart, change == StatusChange::NotFound ? 404 : 409, message, keepAlive);
+            return;
+        }
+        json.beginObject().key("ids").beginArray();
+        for (int id : ids) json.value(id);
+        json.endArray().key("ok").value(true).endObject();
+        finishHttpResponse(out, bodyStart, 200, keepAlive);
+        return;
+    }
+
+    const string_view prefix = "/books/";
+    if (path.substr(0, prefix.size()) == prefix) {
+        string_view rest = path.substr(prefix.size());
+        size_t slash = rest.find('/');
+        string_view action = (slash == string_view::npos) ? string_view() : rest.substr(slash + 1);
+        int id = 0;
+        if (!parseInt(rest.substr(0, slash), id)) {
+            writeHttpError(out, bodyStart, 404, "Not found.", keepAlive);
+            return;
+        }
+
+        bool found;
+        if (request.method == "DELETE" && action.empty()) {
+            found = catalog.deleteBookById(id);
+        }
+        else if (request.method == "POST" && (action == "checkout" || action == "checkin")) {
+            StatusChange change = catalog.updateBookStatus(id, action == "checkout");
+            if (change == StatusChange::Unchanged) {
+                writeHttpError(out, bodyStart, 409, action == "checkout"
+                    ? "Book is already checked out." : "Book is already checked in.", keepAlive);
+                return;
+            }
+            found = change == StatusChange::Updated;
+        }
+        else {
+            writeHttpError(out, bodyStart, 405, "Unsupported method for this path.", keepAlive);
+            return;
+        }
+
+        if (!found) {
+            writeHttpError(out, bodyStart, 404, "Book not found.", keepAlive);
+            return;
+        }
+        json.beginObject().key("id").value(id).key("ok").value(true).endObject();
+        finishHttpResponse(out, bodyStart, 200, keepAlive);
+        return;
+    }
+
+    writeHttpError(out, bodyStart, 404, "Not found.", keepAlive);
+}
+
+#ifndef _WIN32
+bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool readExact(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+// Blocking read of one whole frame, header included.
+bool readFrame(int fd, string& frame) {
+    frame.resize(FRAME_HEADER_SIZE);
+    if (!readExact(fd, &frame[0], FRAME_HEADER_SIZE)) return false;
+    size_t size = completeFrameSize(frame);
+    if (size == SIZE_MAX) return false;
+    size_t body = WireReader(frame).u32();
+    frame.resize(FRAME_HEADER_SIZE + body);
+    return body == 0 || readExact(fd, &frame[FRAME_HEADER_SIZE], body);
+}
+
+bool makeSocketAddress(const string& path, sockaddr_un& address) {
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    copy(path.begin(), path.end(), address.sun_path);
+    return true;
+}
+
+// Returns a connected socket, or -1 if no server is listening at path.
+int connectToServer(const string& path) {
+    sockaddr_un address;
+    if (!makeSocketAddress(path, address)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+volatile sig_atomic_t stopRequested = 0;
+
+void handleStopSignal(int) {
+    stopRequested = 1;
+}
+
+void serveClient(Catalog& catalog, int fd) {
+    string request;
+    string reply;
+    while (readFrame(fd, request)) {
+        reply.clear();
+        if (!handleFrame(catalog, string_view(request).substr(FRAME_HEADER_SIZE), reply)) break;
+        catalog.persist();
+        if (!sendAll(fd, reply)) break;
+    }
+    close(fd);
+}
+
+// Client library for the catalog server. Operations are queued and then sent
+// together in one frame by execute(), so a burst of checkouts costs a single
+// round trip. The call* helpers send one operation on their own.
+class CatalogClient {
+private:
+    int fd;
+    string request;
+    size_t frameStart = 0;
+    uint16_t queued = 0;
+    string reply;
+
+public:
+    explicit CatalogClient(int fd) : fd(fd) {
+    }
+
+    ~CatalogClient() { close(fd); }
+
+    CatalogClient(const CatalogClient&) = delete;
+    CatalogClient& operator=(const CatalogClient&) = delete;
+
+    void queue(Opcode opcode, int id = 0, uint32_t count = 0, string_view title = {}, string_view author = {}) {
+        if (queued == 0) {
+            request.clear();
+            frameStart = beginFrame(request);
+        }
+        putRequest(request, opcode, id, count, title, author);
+        queued++;
+    }
+
+    // Sends every queued operation and decodes the replies, one per operation.
+    bool execute(vector<ReplyOp>& replies) {
+        uint16_t sent = queued;
+        queued = 0;
+        replies.clear();
+        endFrame(request, frameStart, sent);
+        if (!sendAll(fd, request) || !readFrame(fd, reply)) return false;
+
+        WireReader in(string_view(reply).substr(FRAME_HEADER_SIZE));
+        if (in.u16() != sent) return false;
+        replies.resize(sent);
+        for (auto& r : replies) {
+            r.status = static_cast<ReplyStatus>(in.u8());
+            r.more = (in.u8() & REPLY_MORE) != 0;
+            r.id = in.i32();
+            uint32_t rows = in.u32();
+            for (uint32_t i = 0; i < rows && in.ok(); i++) {
+                int id = in.i32();
+                uint8_t flags = in.u8();
+                string_view title = in.str();
+                string_view author = in.str();
+                r.rows.emplace_back(id, string(title), string(author), (flags & ROW_CHECKED_OUT) != 0);
+                r.authorMatches.push_back((flags & ROW_AUTHOR_MATCH) != 0);
+            }
+        }
+        return in.ok();
+    }
+
+    bool call(Opcode opcode, ReplyOp& result, int id = 0, uint32_t count = 0,
+        string_view title = {}, string_view author = {}) {
+        vector<ReplyOp> replies;
+        queue(opcode, id, count, title, author);
+        if (!execute(replies)) return false;
+        result = std::move(replies[0]);
+        return true;
+    }
+};
+
+#ifdef __linux__
+// A slice of one connection's input handed to a pool worker. The worker runs
+// every complete request in input, leaves any partial request there, and fills
+// output with the replies.
+struct RequestBatch {
+    int fd;
+    uint64_t serial;              // tells a reused fd apart from the connection that sent this
+    bool http = false;
+    string input;
+    string output;
+    bool closeAfterWrite = false; // HTTP client asked for Connection: close
+    bool ok = true;               // false if the client sent something malformed
+};
+
+// One client connection in the event loop. While a batch of its requests is on
+// a worker the connection is busy, which keeps replies in request order; new
+// bytes wait in input until the batch comes back.
+struct Connection {
+    int fd;
+    uint64_t serial = 0;
+    bool http = false;            // accepted on the HTTP listener
+    bool busy = false;
+    bool closeAfterWrite = false;
+    string input;
+    string output;
+    size_t outputSent = 0;
+    bool wantsWrite = false;
+};
+
+// Runs every complete request in the batch's input and drops the bytes it used.
+void processInput(Catalog& catalog, RequestBatch& batch, const ThreadPool* pool) {
+    size_t start = 0;
+
+    while (batch.ok && !batch.closeAfterWrite) {
+        string_view pending = string_view(batch.input).substr(start);
+        if (batch.http) {
+            HttpRequest request;
+            size_t size = 0;
+            HttpParse result = parseHttpRequest(pending, request, size);
+            if (result == HttpParse::Incomplete) break;
+            if (result == HttpParse::Bad) {
+                writeHttpError(batch.output, batch.output.size(), 400, "Malformed request.", false);
+                batch.closeAfterWrite = true;
+                break;
+            }
+            handleHttpRequest(catalog, request, batch.output, pool);
+            if (!request.keepAlive) batch.closeAfterWrite = true;
+            start += size;
+        }
+        else {
+            size_t size = completeFrameSize(pending);
+            if (size == 0) break;
+            batch.ok = size != SIZE_MAX
+                && handleFrame(catalog, pending.substr(FRAME_HEADER_SIZE, size - FRAME_HEADER_SIZE), batch.output);
+            start += size;
+        }
+    }
+
+    batch.input.erase(0, start);
+}
+
+// True if input holds at least the start of a whole request, so a batch is
+// worth handing to a worker. A bad request also counts, so it gets rejected.
+bool hasCompleteRequest(const Connection& c) {
+    if (c.http) return c.input.find("\r\n\r\n") != string::npos || c.input.size() > MAX_HTTP_HEADER_SIZE;
+    return completeFrameSize(c.input) != 0;
+}
+
+// Stop reading from a client whose unsent replies pass this size until it
+// catches up, so one slow reader cannot make the server buffer without limit.
+const size_t MAX_PENDING_OUTPUT = 4 << 20;
+
+void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Sends as much pending output as the socket takes. Returns false if the
+// connection is broken.
+bool flushConnection(Connection& c) {
+    while (c.outputSent < c.output.size()) {
+        ssize_t n = send(c.fd, c.output.data() + c.outputSent, c.output.size() - c.outputSent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (n <= 0) return false;
+        c.outputSent += static_cast<size_t>(n);
+    }
+    c.output.clear();
+    c.outputSent = 0;
+    return true;
+}
+
+void updateInterest(int epollFd, Connection& c) {
+    bool pending = c.outputSent < c.output.size();
+    epoll_event event = {};
+    event.events = (pending ? uint32_t(EPOLLOUT) : 0u) | (c.output.size() < MAX_PENDING_OUTPUT ? uint32_t(EPOLLIN) : 0u);
+    event.data.fd = c.fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, c.fd, &event);
+    c.wantsWrite = pending;
+}
+
+// Finished batches travel back to the event loop through here; the eventfd
+// wakes epoll_wait when one arrives.
+struct CompletionQueue {
+    mutex m;
+    vector<RequestBatch> done;
+    int eventFd = -1;
+
+    void push(RequestBatch&& batch) {
+        {
+            lock_guard<mutex> guard(m);
+            done.push_back(std::move(batch));
+        }
+        uint64_t one = 1;
+        ssize_t written = write(eventFd, &one, sizeof(one));
+        (void)written; // the counter only needs to become non-zero
+    }
+};
+
+// The epoll loop does the I/O and the pool does the work. Each wake-up reads
+// whatever arrived and hands every idle connection with a complete request to
+// a worker as one batch. When batches come back, the catalog is persisted once
+// for all of them and each connection is answered with one write.
+// httpListener is -1 when the HTTP endpoint is turned off.
+// backgroundSaveMs of 0 saves before every reply (group commit); otherwise the
+// catalog is saved by a forked child at most that often, and replies do not
+// wait for the disk.
+void runEventLoop(Catalog& catalog, ThreadPool& pool, int listener, int httpListener, int backgroundSaveMs) {
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    CompletionQueue completions;
+    completions.eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    for (int fd : { listener, httpListener, completions.eventFd }) {
+        if (fd < 0) continue;
+        setNonBlocking(fd);
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    map<int, Connection> connections;
+    vector<epoll_event> events(256);
+    vector<RequestBatch> finished;
+    vector<int> ready;
+    uint64_t nextSerial = 1;
+    auto nextSave = chrono::steady_clock::now() + chrono::milliseconds(backgroundSaveMs);
+
+    auto dispatch = [&](Connection& c) {
+        if (c.busy || !hasCompleteRequest(c)) return;
+        RequestBatch batch;
+        batch.fd = c.fd;
+        batch.serial = c.serial;
+        batch.http = c.http;
+        batch.input = std::move(c.input);
+        c.input.clear();
+        c.busy = true;
+        pool.submit([&catalog, &completions, &pool, batch = std::move(batch)]() mutable {
+            processInput(catalog, batch, &pool);
+            completions.push(std::move(batch));
+        });
+    };
+
+    while (!stopRequested) {
+        int timeout = backgroundSaveMs > 0 ? min(backgroundSaveMs, 100) : -1;
+        int count = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), timeout);
+        if (count < 0) continue; // interrupted by a signal
+
+        ready.clear();
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == completions.eventFd) {
+                uint64_t counter;
+                ssize_t drained = read(fd, &counter, sizeof(counter));
+                (void)drained;
+                continue;
+            }
+
+            if (fd == listener || fd == httpListener) {
+                int client;
+                while ((client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    if (fd == httpListener) {
+                        int on = 1;
+                        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    }
+                    epoll_event clientEvent = {};
+                    clientEvent.events = EPOLLIN;
+                    clientEvent.data.fd = client;
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &clientEvent);
+                    Connection& c = connections[client];
+                    c = Connection();
+                    c.fd = client;
+                    c.serial = nextSerial++;
+                    c.http = (fd == httpListener);
+                }
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            Connection& c = it->second;
+            bool closed = (events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & EPOLLIN);
+
+            if (events[i].events & EPOLLIN) {
+                char chunk[16384];
+                while (true) {
+                    ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+                    if (received > 0) {
+                        c.input.append(chunk, static_cast<size_t>(received));
+                        continue;
+                    }
+                    if (received < 0 && errno == EINTR) continue;
+                    if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) closed = true;
+                    break;
+                }
+            }
+
+            if (closed) {
+                // A batch still on a worker is dropped when it comes back.
+                close(fd);
+                connections.erase(it);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) ready.push_back(fd);
+            dispatch(c);
+        }
+
+        {
+            lock_guard<mutex> guard(completions.m);
+            finished.swap(completions.done);
+        }
+
+        if (backgroundSaveMs > 0) {
+            if (catalog.finishBackgroundSave()) {
+                Catalog::SnapshotReport report = catalog.lastBackgroundSave();
+                cout << "Background save: " << report.books << " books in "
+                    << static_cast<int>(report.seconds * 1000) << " ms, "
+                    << report.copyOnWriteBytes / 1024 << " KB copied on write." << endl;
+            }
+            auto now = chrono::steady_clock::now();
+            if (now >= nextSave) {
+                catalog.startBackgroundSave();
+                nextSave = now + chrono::milliseconds(backgroundSaveMs);
+            }
+        }
+        else if (!finished.empty()) {
+            // Group commit: one save covers every batch that just finished, and
+            // no reply leaves the server before its change is on disk.
+            catalog.persist();
+        }
+
+        for (auto& batch : finished) {
+            auto it = connections.find(batch.fd);
+            if (it == connections.end() || it->second.serial != batch.serial) continue;
+            Connection& c = it->second;
+            c.busy = false;
+            batch.input += c.input;
+            c.input = std::move(batch.input);
+            c.output += batch.output;
+            c.closeAfterWrite = c.closeAfterWrite || batch.closeAfterWrite;
+            if (!batch.ok) {
+                close(c.fd);
+                connections.erase(it);
+                continue;
+            }
+            ready.push_back(c.fd);
+        }
+        finished.clear();
+
+        for (int fd : ready) {
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            Connection& c = it->second;
+            if (!flushConnection(c) || (c.closeAfterWrite && c.output.empty())) {
+                close(fd);
+                connections.erase(it);
+                continue;
+            }
+            bool pending = c.outputSent < c.output.size();
+            if (pending != c.wantsWrite || c.output.size() >= MAX_PENDING_OUTPUT) {
+                updateInterest(epollFd, c);
+            }
+            if (!c.closeAfterWrite) dispatch(c);
+        }
+    }
+
+    // Workers still hold references to the completion queue.
+    pool.waitIdle();
+    for (auto& entry : connections) close(entry.first);
+    close(completions.eventFd);
+    close(epollFd);
+}
+#endif
+
+void printPoolStats(const ThreadPool& pool) {
+    vector<ThreadPool::WorkerStats> stats = pool.stats();
+    cout << "\nWorker pool:" << endl;
+    for (size_t i = 0; i < stats.size(); i++) {
+        cout << "  worker " << i << ": " << stats[i].executed << " tasks, "
+            << stats[i].steals << " stolen, " << stats[i].queued << " queued" << endl;
+    }
+}
+
+struct ServerOptions {
+    string socketPath = DEFAULT_SOCKET;
+    int httpPort = 0;           // 0 leaves the HTTP endpoint off
+    int backgroundSaveMs = 0;   // 0 saves before every reply instead
+};
+
+// Listens on 127.0.0.1 only; the kiosks run on the same machine.
+int openHttpListener(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 512) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Loads the catalog once and serves it until SIGINT or SIGTERM. Linux uses the
+// epoll event loop; other systems fall back to one thread per connected terminal.
+int runServer(const string& filename, const ServerOptions& options) {
+    const string& socketPath = options.socketPath;
+    int existing = connectToServer(socketPath);
+    if (existing >= 0) {
+        close(existing);
+        cerr << "\nError: A catalog server is already listening on " << socketPath << "." << endl;
+        return 1;
+    }
+
+    Catalog catalog(filename);
+    LoadReport report = catalog.load();
+    catalog.prepareSuggestions();
+    printLoadReport(report, cout);
+
+    sockaddr_un address;
+    if (!makeSocketAddress(socketPath, address)) {
+        cerr << "\nError: Socket path " << socketPath << " is too long." << endl;
+        return 1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socketPath.c_str()); // left behind by a server that did not shut down cleanly
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listener, 64) != 0) {
+        cerr << "\nError: Could not listen on " << socketPath << ": " << strerror(errno) << endl;
+        if (listener >= 0) close(listener);
+        return 1;
+    }
+
+    int httpListener = -1;
+    if (options.httpPort > 0) {
+#ifdef __linux__
+        httpListener = openHttpListener(options.httpPort);
+        if (httpListener < 0) {
+            cerr << "\nError: Could not listen on port " << options.httpPort << ": " << strerror(errno) << endl;
+            close(listener);
+            unlink(socketPath.c_str());
+            return 1;
+        }
+        cout << "HTTP endpoint on http://127.0.0.1:" << options.httpPort << "/books" << endl;
+#else
+        cerr << "\nWarning: The HTTP endpoint needs the Linux event loop; it is turned off." << endl;
+#endif
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = handleStopSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    cout << "Serving " << catalog.size() << " books from " << filename << " on " << socketPath
+        << ". Press Ctrl+C to stop." << endl;
+
+#ifdef __linux__
+    ThreadPool pool(max(2u, thread::hardware_concurrency()));
+    runEventLoop(catalog, pool, listener, httpListener, options.backgroundSaveMs);
+    printPoolStats(pool);
+#else
+    if (options.backgroundSaveMs > 0) {
+        cerr << "\nWarning: Background saves need the Linux event loop; saving before every reply." << endl;
+    }
+    while (!stopRequested) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) continue; // interrupted by a signal, or a client that gave up
+        thread(serveClient, ref(catalog), client).detach();
+    }
+#endif
+
+    catalog.persist();
+    if (httpListener >= 0) close(httpListener);
+    close(listener);
+    unlink(socketPath.c_str());
+    cout << "\nCatalog server stopped." << endl;
+    return 0;
+}
+
+// How far a standby trails the catalog it follows.
+struct ReplicationLag {
+    uint64_t appliedSeq = 0;
+    uint64_t primarySeq = 0;
+    int64_t delayMs = 0;    // time between logging and applying the newest entry
+};
+
+void printReplicationLag(const ReplicationLag& lag, size_t books) {
+    cout << "Standby: applied through #" << lag.appliedSeq << ", "
+        << (lag.primarySeq > lag.appliedSeq ? lag.primarySeq - lag.appliedSeq : 0) << " behind, "
+        << "lag " << lag.delayMs << " ms, " << books << " books." << endl;
+}
+
+// Keeps a warm copy of the catalog in replicaName by tailing the primary's
+// mutation log. The copy starts from the primary's file, taken under its lock
+// together with the log's current end, and every line appended after that is
+// replayed in order and saved to the copy. If the log shrinks (it was replaced
+// or cleared) the standby starts over from a fresh copy.
+int runStandby(const string& primary, const string& replicaName) {
+    if (replicaName == primary) {
+        cerr << "\nError: The standby needs its own file, not " << primary << "." << endl;
+        return 1;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = handleStopSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    const string logName = mutationLogName(primary);
+    unique_ptr<Catalog> replica;
+    uintmax_t offset = 0;
+    ReplicationLag lag;
+
+    auto takeCopy = [&]() {
+        FileLock lock(primary, FileLock::Shared);
+        error_code ec;
+        filesystem::copy_file(primary, replicaName, filesystem::copy_options::overwrite_existing, ec);
+        if (ec) {
+            cerr << "\nError: Could not copy " << primary << " to " << replicaName << ": " << ec.message() << endl;
+            return false;
+        }
+        lag.appliedSeq = lastLoggedSeq(primary);
+        offset = filesystem::exists(logName) ? filesystem::file_size(logName, ec) : 0;
+        replica = make_unique<Catalog>(replicaName);
+        replica->disableMutationLog();
+        replica->load();
+        return true;
+    };
+
+    if (!takeCopy()) return 1;
+    cout << "Standby for " << primary << " in " << replicaName << ", starting after log entry #"
+        << lag.appliedSeq << ". Press Ctrl+C to stop." << endl;
+
+    auto lastReport = chrono::steady_clock::now();
+    bool changedSinceReport = false;
+    string chunk;
+    while (true) {
+        bool stopping = stopRequested; // catch up once more before stopping
+        error_code ec;
+        uintmax_t size = filesystem::exists(logName) ? filesystem::file_size(logName, ec) : 0;
+        if (size < offset) {
+            cout << "Standby: " << logName << " was replaced; taking a fresh copy." << endl;
+            if (!takeCopy()) return 1;
+            continue;
+        }
+
+        if (size > offset) {
+            ifstream log(logName, ios::binary);
+            log.seekg(static_cast<streamoff>(offset));
+            chunk.resize(static_cast<size_t>(size - offset));
+            log.read(&chunk[0], static_cast<streamsize>(chunk.size()));
+            chunk.resize(static_cast<size_t>(log.gcount()));
+
+            // Only complete lines; a line still being written is picked up next time.
+            size_t consumed = 0, newline;
+            Mutation m;
+            while ((newline = chunk.find('\n', consumed)) != string::npos) {
+                string_view line(chunk.data() + consumed, newline - consumed);
+                consumed = newline + 1;
+                if (!parseMutation(line, m)) {
+                    cerr << "Standby: skipping unreadable log line \"" << line << "\"." << endl;
+                    continue;
+                }
+                if (m.seq <= lag.appliedSeq) continue; // already in the copy
+                if (m.seq != lag.appliedSeq + 1) {
+                    cerr << "Standby: log jumps from #" << lag.appliedSeq << " to #" << m.seq << "." << endl;
+                }
+                replica->applyMutation(m);
+                lag.appliedSeq = m.seq;
+                lag.delayMs = currentTimeMs() - m.timeMs;
+                changedSinceReport = true;
+            }
+            offset += consumed;
+            replica->persist();
+        }
+
+        auto now = chrono::steady_clock::now();
+        if (changedSinceReport && now - lastReport >= chrono::seconds(5)) {
+            lag.primarySeq = lastLoggedSeq(primary);
+            printReplicationLag(lag, replica->size());
+            lastReport = now;
+            changedSinceReport = false;
+        }
+        if (stopping) break;
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+
+    replica->persist();
+    lag.primarySeq = lastLoggedSeq(primary);
+    printReplicationLag(lag, replica->size());
+    cout << "\nStandby stopped." << endl;
+    return 0;
+}
+#endif
+
+/* ------------------------
+ * Library Backends
+ * ------------------------
+ */
+// What the menu talks to. FileBackend works on library.csv directly; RemoteBackend
+// forwards each operation to a running catalog server.
+class LibraryBackend {
+public:
+    virtual ~LibraryBackend() = default;
+
+    virtual bool isEmpty() = 0;
+    virtual bool printPage(int& cursor, size_t pageSize, ListFilter filter) = 0;
+    virtual bool printSearchPage(const string& query, bool fuzzy, int& cursor, size_t pageSize) = 0;
+    virtual bool printFilterPage(const FilterExpr& filter, const string& text, int& cursor, size_t pageSize) = 0;
+    virtual bool printAuthorPage(const string& author, ListFilter filter, int& cursor, size_t pageSize) = 0;
+    // The cursor is a position in the order, not an ID.
+    virtual bool printSortedPage(SortOrder order, ListFilter filter, int& cursor, size_t pageSize) = 0;
+    virtual size_t printSuggestions(const string& prefix, size_t count) = 0;
+    virtual int addBook(const string& title, const string& author) = 0;
+    virtual bool updateBookStatus(int id, bool checkOut) = 0;
+    virtual bool updateBooksStatus(const vector<int>& ids, bool checkOut) = 0;
+    virtual bool deleteBookById(int id) = 0;
+};
+
+class FileBackend : public LibraryBackend {
+private:
+    string filename;
+
+public:
+    explicit FileBackend(string filename) : filename(std::move(filename)) {
+    }
+
+    bool isEmpty() override {
+        FileLock lock(filename, FileLock::Shared);
+        return getOffsetIndex(filename).entries.empty();
+    }
+
+    bool printPage(int& cursor, size_t pageSize, ListFilter filter) override {
+        return listBooksPage(filename, cursor, pageSize, filter);
+    }
+
+    bool printSearchPage(const string& query, bool fuzzy, int& cursor, size_t pageSize) override {
+        SearchQuery parsed = parseSearchQuery(query);
+        parsed.fuzzy = fuzzy;
+        return searchBooksPage(filename, parsed, cursor, pageSize);
+    }
+
+    bool printFilterPage(const FilterExpr& filter, const string&, int& cursor, size_t pageSize) override {
+        return filterBooksPage(filename, filter, cursor, pageSize);
+    }
+
+    bool printAuthorPage(const string& author, ListFilter filter, int& cursor, size_t pageSize) override {
+        return listAuthorBooksPage(filename, author, filter, cursor, pageSize);
+    }
+
+    bool printSortedPage(SortOrder order, ListFilter filter, int& cursor, size_t pageSize) override {
+        return listSortedBooksPage(filename, order, filter, cursor, pageSize);
+    }
+
+    size_t printSuggestions(const string& prefix, size_t count) override {
+        vector<Suggestion> suggestions = suggestFromFile(filename, prefix, count);
+        ::printSuggestions(suggestions);
+        return suggestions.size();
+    }
+
+    int addBook(const string& title, const string& author) override {
+        int id = ::addBook(filename, title, author);
+        if (id < 0) cout << "\nError: " << BAD_FIELD_MESSAGE << endl;
+        return id;
+    }
+
+    bool updateBookStatus(int id, bool checkOut) override {
+        return ::updateBookStatus(filename, id, checkOut);
+    }
+
+    bool updateBooksStatus(const vector<int>& ids, bool checkOut) override {
+        return ::updateBooksStatus(filename, ids, checkOut);
+    }
+
+    bool deleteBookById(int id) override {
+        return ::deleteBookById(filename, id);
+    }
+};
+
+#ifndef _WIN32
+class RemoteBackend : public LibraryBackend {
+private:
+    CatalogClient client;
+
+    bool call(Opcode opcode, ReplyOp& reply, int id = 0, uint32_t count = 0,
+        string_view title = {}, string_view author = {}) {
+        if (!client.call(opcode, reply, id, count, title, author)) {
+            cout << "\nError: Lost connection to the catalog server." << endl;
+            return false;
+        }
+        return true;
+    }
+
+public:
+    explicit RemoteBackend(int fd) : client(fd) {
+    }
+
+    bool isEmpty() override {
+        ReplyOp reply;
+        return !call(Opcode::GetPage, reply, 0, 1) || reply.rows.empty();
+    }
+
+    // The server pages by ID only, so filtered listings are trimmed here and may
+    // take more than one request to fill a page.
+    bool printPage(int& cursor, size_t pageSize, ListFilter filter) override {
+        OutputBuffer out;
+        size_t shown = 0;
+        bool more = true;
+        ReplyOp reply;
+        while (more && shown < pageSize) {
+            if (!call(Opcode::GetPage, reply, cursor, static_cast<uint32_t>(pageSize))) return false;
+            more = reply.more;
+            for (const auto& b : reply.rows) {
+                if (shown == pageSize) {
+                    more = true;
+                    break;
+                }
+                cursor = b.getId();
+                if (!matchesFilter(b.getCheckedOut(), filter)) continue;
+                b.print(out);
+                shown++;
+            }
+        }
+        out.flush();
+        return more;
+    }
+
+    bool printSearchPage(const string& query, bool fuzzy, int& cursor, size_t pageSize) override {
+        ReplyOp reply;
+        if (!call(fuzzy ? Opcode::FuzzySearch : Opcode::Search, reply, cursor,
+            static_cast<uint32_t>(pageSize), query)) return false;
+        OutputBuffer out;
+        for (const auto& b : reply.rows) {
+            b.print(out);
+            cursor = b.getId();
+        }
+        out.flush();
+        return reply.more;
+    }
+
+    // The server parses the text again; the caller has already checked it.
+    bool printFilterPage(const FilterExpr&, const string& text, int& cursor, size_t pageSize) override {
+        ReplyOp reply;
+        if (!call(Opcode::Filter, reply, cursor, static_cast<uint32_t>(pageSize), text)) return false;
+        if (reply.status != ReplyStatus::Ok) {
+            cout << "\nError: " << describeReplyStatus(reply.status) << endl;
+            return false;
+        }
+        OutputBuffer out;
+        for (const auto& b : reply.rows) {
+            b.print(out);
+            cursor = b.getId();
+        }
+        out.flush();
+        return reply.more;
+    }
+
+    // Only the available filter is sent to the server; a checked-out listing is
+    // trimmed here.
+    bool printAuthorPage(const string& author, ListFilter filter, int& cursor, size_t pageSize) override {
+        OutputBuffer out;
+        size_t shown = 0;
+        bool more = true;
+        ReplyOp reply;
+        string_view sent = filter == ListFilter::Available ? "available" : "";
+        while (more && shown < pageSize) {
+            if (!call(Opcode::AuthorBooks, reply, cursor, static_cast<uint32_t>(pageSize), sent, author)) return false;
+            more = reply.more;
+            for (const auto& b : reply.rows) {
+                if (shown == pageSize) {
+                    more = true;
+                    break;
+                }
+                cursor = b.getId();
+                if (!matchesFilter(b.getCheckedOut(), filter)) continue;
+                b.print(out);
+                shown++;
+            }
+        }
+        out.flush();
+        return more;
+    }
+
+    bool printSortedPage(SortOrder order, ListFilter filter, int& cursor, size_t pageSize) override {
+        ReplyOp reply;
+        string_view sent = filter == ListFilter::Available ? "available"
+            : filter == ListFilter::CheckedOut ? "checked-out" : "";
+        if (!call(Opcode::SortedPage, reply, cursor, static_cast<uint32_t>(pageSize), sortOrderName(order), sent)) {
+            return false;
+        }
+        if (reply.status != ReplyStatus::Ok) {
+            cout << "\nError: " << describeReplyStatus(reply.status) << endl;
+            return false;
+        }
+        OutputBuffer out;
+        for (const auto& b : reply.rows) b.print(out);
+        out.flush();
+        cursor = reply.id;
+        return reply.more;
+    }
+
+    // Rows come back as whole books, flagged when the author is what matched.
+    size_t printSuggestions(const string& prefix, size_t count) override {
+        ReplyOp reply;
+        if (!call(Opcode::Suggest, reply, 0, static_cast<uint32_t>(count), prefix)) return 0;
+        vector<Suggestion> suggestions;
+        for (size_t i = 0; i < reply.rows.size(); i++) {
+            suggestions.push_back({ std::move(reply.rows[i]), reply.authorMatches[i] });
+        }
+        ::printSuggestions(suggestions);
+        return suggestions.size();
+    }
+
+    int addBook(const string& title, const string& author) override {
+        ReplyOp reply;
+        if (!call(Opcode::AddBook, reply, 0, 0, title, author)) return -1;
+        if (reply.status != ReplyStatus::Ok) {
+            cout << "\nError: " << describeReplyStatus(reply.status) << endl;
+            return -1;
+        }
+        return reply.id;
+    }
+
+    bool updateBookStatus(int id, bool checkOut) override {
+        ReplyOp reply;
+        if (!call(checkOut ? Opcode::CheckOut : Opcode::CheckIn, reply, id)) return false;
+        if (reply.status == ReplyStatus::Conflict) {
+            cout << "\nError: Book with ID " << id << " is already "
+                << (checkOut ? "checked out" : "checked in") << "." << endl;
+            return false;
+        }
+        if (reply.status != ReplyStatus::Ok) {
+            cout << "\nError: Book with ID " << id << ": " << describeReplyStatus(reply.status) << endl;
+            return false;
+        }
+        cout << "\nUpdated book with ID " << id << " to "
+            << (checkOut ? "Checked Out" : "Available") << "." << endl;
+        return true;
+    }
+
+    bool updateBooksStatus(const vector<int>& ids, bool checkOut) override {
+        string packed;
+        for (int id : ids) putI32(packed, id);
+        ReplyOp reply;
+        if (!call(checkOut ? Opcode::CheckOutAll : Opcode::CheckInAll, reply, 0,
+            static_cast<uint32_t>(ids.size()), packed)) return false;
+        switch (reply.status) {
+        case ReplyStatus::Ok: return reportStatusChanges(ids, checkOut, StatusChange::Updated, 0);
+        case ReplyStatus::NotFound: return reportStatusChanges(ids, checkOut, StatusChange::NotFound, reply.id);
+        case ReplyStatus::Conflict: return reportStatusChanges(ids, checkOut, StatusChange::Unchanged, reply.id);
+        default:
+            cout << "\nError: " << describeReplyStatus(reply.status) << endl;
+            return false;
+        }
+    }
+
+    bool deleteBookById(int id) override {
+        ReplyOp reply;
+        if (!call(Opcode::DeleteBook, reply, id)) return false;
+        if (reply.status != ReplyStatus::Ok) {
+            cout << "\nError: Book with ID " << id << ": " << describeReplyStatus(reply.status) << endl;
+            return false;
+        }
+        cout << "\nDeleted book with ID " << id << " from the library." << endl;
+        return true;
+    }
+};
+#endif
+
+// Works on a catalog loaded into this process. Command-line runs use it so a
+// whole batch of commands costs one load and one save of the file.
+class CatalogBackend : public LibraryBackend {
+private:
+    Catalog& catalog;
+    vector<Book> page;
+
+    bool printRows(bool more, int& cursor) {
+        OutputBuffer out;
+        for (const auto& b : page) {
+            b.print(out);
+            cursor = b.getId();
+        }
+        out.flush();
+        return more;
+    }
+
+public:
+    explicit CatalogBackend(Catalog& catalog) : catalog(catalog) {
+    }
+
+    bool isEmpty() override {
+        return catalog.size() == 0;
+    }
+
+    bool printPage(int& cursor, size_t pageSize, ListFilter filter) override {
+        return printRows(catalog.getPage(cursor, pageSize, page, filter), cursor);
+    }
+
+    bool printSearchPage(const string& query, bool fuzzy, int& cursor, size_t pageSize) override {
+        SearchQuery parsed = parseSearchQuery(query);
+        parsed.fuzzy = fuzzy;
+        return printRows(catalog.search(parsed, cursor, pageSize, page), cursor);
+    }
+
+    bool printFilterPage(const FilterExpr& filter, const string&, int& cursor, size_t pageSize) override {
+        return printRows(catalog.filter(filter, cursor, pageSize, page), cursor);
+    }
+
+    bool printAuthorPage(const string& author, ListFilter filter, int& cursor, size_t pageSize) override {
+        return printRows(catalog.booksByAuthor(author, filter, cursor, pageSize, page), cursor);
+    }
+
+    bool printSortedPage(SortOrder order, ListFilter filter, int& cursor, size_t pageSize) override {
+        bool more = catalog.sortedPage(order, filter, cursor, pageSize, page);
+        OutputBuffer out;
+        for (const auto& b : page) b.print(out);
+        out.flush();
+        return more;
+    }
+
+    size_t printSuggestions(const string& prefix, size_t count) override {
+        vector<Suggestion> suggestions = catalog.suggest(prefix, count);
+        ::printSuggestions(suggestions);
+        return suggestions.size();
+    }
+
+    int addBook(const string& title, const string& author) override {
+        int id = catalog.addBook(title, author);
+        if (id < 0) cout << "\nError: " << BAD_FIELD_MESSAGE << endl;
+        return id;
+    }
+
+    bool updateBookStatus(int id, bool checkOut) override {
+        return reportStatusChanges({ id }, checkOut, catalog.updateBookStatus(id, checkOut), id);
+    }
+
+    bool updateBooksStatus(const vector<int>& ids, bool checkOut) override {
+        int failedId = 0;
+        StatusChange change = catalog.updateBooksStatus(ids, checkOut, failedId);
+        return reportStatusChanges(ids, checkOut, change, failedId);
+    }
+
+    bool deleteBookById(int id) override {
+        if (!catalog.deleteBookById(id)) {
+            cout << "\nError: Book with ID " << id << " not found." << endl;
+            return false;
+        }
+        cout << "\nDeleted book with ID " << id << " from the library." << endl;
+        return true;
+    }
+};
+
+bool askForMore() {
+    cout << "\n-- Press Enter for more, or q to stop: ";
+    string reply;
+    return getline(cin, reply) && reply != "q" && reply != "Q";
+}
+
+// Interactive pager used by the menu: shows one page at a time and waits for the
+// user before fetching the next one, so large catalogs do not flood the terminal.
+void browseBooks(LibraryBackend& backend, size_t pageSize = 20) {
+    if (backend.isEmpty()) {
+        cout << "\nNo books in the library yet." << endl;
+        return;
+    }
+
+    // Drop the newline left behind by the menu's "cin >> choice".
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+    cout << "\nBooks in the library:" << endl;
+    int cursor = 0;
+    while (backend.printPage(cursor, pageSize, ListFilter::All)) {
+        if (!askForMore()) break;
+    }
+}
+
+// Pages through one author's books the same way.
+void browseAuthor(LibraryBackend& backend, const string& author, ListFilter filter, size_t pageSize = 20) {
+    cout << "\n" << (filter == ListFilter::Available ? "Available books" : "Books") << " by " << author << ":" << endl;
+    int cursor = 0;
+    while (backend.printAuthorPage(author, filter, cursor, pageSize)) {
+        if (!askForMore()) break;
+    }
+}
+
+// Pages through the books matching a search the same way. When no book matches
+// exactly, close spellings of the words are tried before giving up.
+void searchBooks(LibraryBackend& backend, const string& query, size_t pageSize = 20) {
+    int cursor = 0;
+    bool fuzzy = false;
+    bool more = backend.printSearchPage(query, fuzzy, cursor, pageSize);
+    if (cursor == 0) {
+        cout << "\nNo books match \"" << query << "\" exactly. Close matches:" << endl;
+        fuzzy = true;
+        more = backend.printSearchPage(query, fuzzy, cursor, pageSize);
+        if (cursor == 0) {
+            cout << "None." << endl;
+            return;
+        }
+    }
+    while (more && askForMore()) {
+        more = backend.printSearchPage(query, fuzzy, cursor, pageSize);
+    }
+}
+
+/* ------------------------
+ * Command Line
+ * ------------------------
+ */
+const char* const COMMAND_USAGE =
+    "Usage: Library [command]\n"
+    "  (no command)                  interactive menu\n"
+    "  add <title> <author>          add a book\n"
+    "  list [--available|--checked-out] [--sort title|author|status]\n"
+    "                                list books, in ID order unless sorted; titles\n"
+    "                                sort without a leading The, A or An\n"
+    "  checkout <id>...              check out one or more books, all or none\n"
+    "  checkin <id>...               check in one or more books, all or none\n"
+    "  delete <id>...                delete one or more books\n"
+    "  search <words>                find books by title or author words; OR between\n"
+    "                                words matches either side, and misspelled words\n"
+    "                                are tried when nothing matches exactly\n"
+    "  suggest <prefix>              titles and authors starting with prefix\n"
+    "  author <name> [--available]   one author's books, or only those on the shelf\n"
+    "  filter <expression>           books passing a filter, for example\n"
+    "                                status=available AND author~\"Gaiman\" AND id>1000\n"
+    "  check [--rejects <file>]      report rows that fail to parse, and write them\n"
+    "                                to a file with --rejects\n"
+    "  --script <file>               run one command per line from a file\n"
+    "  serve [socket] [--http <port>] [--background-save <ms>]\n"
+    "  standby [copy.csv]            follow library.csv.log into a warm copy";
+
+bool isCommand(const string& word) {
+    return word == "add" || word == "list" || word == "checkout" || word == "checkin"
+        || word == "delete" || word == "search" || word == "suggest" || word == "author" || word == "filter" || word == "--script";
+}
+
+// Commands that only read the catalog, so they can share the file with others.
+bool isReadOnlyCommand(const string& word) {
+    return word == "list" || word == "search" || word == "suggest" || word == "author" || word == "filter";
+}
+
+// Splits a script line into words. Double quotes group words containing spaces,
+// so titles can be written as add "The Hobbit" "J.R.R. Tolkien". Quotes that
+// open in the middle of a word are kept, so filters can say author~"Neil Gaiman".
+vector<string> splitCommandLine(const string& line) {
+    vector<string> words;
+    string word;
+    bool quoted = false, inWord = false, keepQuotes = false;
+    for (char c : line) {
+        if (c == '"') {
+            if (!quoted) keepQuotes = !word.empty();
+            if (keepQuotes) word += c;
+            quoted = !quoted;
+            inWord = true;
+        }
+        else if (!quoted && isspace(static_cast<unsigned char>(c))) {
+            if (inWord) words.push_back(word);
+            word.clear();
+            inWord = false;
+        }
+        else {
+            word += c;
+            inWord = true;
+        }
+    }
+    if (inWord) words.push_back(word);
+    return words;
+}
+
+// Runs one command. Returns false if it was malformed or any part of it failed.
+bool runCommand(LibraryBackend& backend, const vector<string>& args) {
+    const string& command = args[0];
+
+    if (command == "add") {
+        if (args.size() != 3) {
+            cerr << "\nUsage: add <title> <author>" << endl;
+            return false;
+        }
+        int id = backend.addBook(args[1], args[2]);
+        if (id < 0) return false;
+        cout << "\nAdded \"" << args[1] << "\" by " << args[2] << " with ID " << id << "." << endl;
+        return true;
+    }
+
+    if (command == "list") {
+        ListFilter filter = ListFilter::All;
+        bool sorted = false;
+        SortOrder order = SortOrder::Title;
+        bool valid = true;
+        for (size_t i = 1; i < args.size() && valid; i++) {
+            if (args[i] == "--available" && filter == ListFilter::All) filter = ListFilter::Available;
+            else if (args[i] == "--checked-out" && filter == ListFilter::All) filter = ListFilter::CheckedOut;
+            else if (args[i] == "--sort" && !sorted && i + 1 < args.size()) sorted = valid = parseSortOrder(args[++i], order);
+            else valid = false;
+        }
+        if (!valid) {
+            cerr << "\nUsage: list [--available|--checked-out] [--sort title|author|status]" << endl;
+            return false;
+        }
+        if (backend.isEmpty()) {
+            cout << "\nNo books in the library yet." << endl;
+            return true;
+        }
+        cout << "\nBooks in the library:" << endl;
+        int cursor = 0;
+        if (sorted) {
+            while (backend.printSortedPage(order, filter, cursor, 1000)) {
+            }
+            return true;
+        }
+        while (backend.printPage(cursor, 1000, filter)) {
+        }
+        return true;
+    }
+
+    if (command == "search") {
+        string query;
+        for (size_t i = 1; i < args.size(); i++) query += (i > 1 ? " " : "") + args[i];
+        if (parseSearchQuery(query).empty()) {
+            cerr << "\nUsage: search <words>" << endl;
+            return false;
+        }
+        int cursor = 0;
+        cout << "\nBooks matching \"" << query << "\":" << endl;
+        while (backend.printSearchPage(query, false, cursor, 1000)) {
+        }
+        if (cursor == 0) {
+            cout << "No exact matches. Close matches:" << endl;
+            while (backend.printSearchPage(query, true, cursor, 1000)) {
+            }
+            if (cursor == 0) cout << "None." << endl;
+        }
+        return true;
+    }
+
+    if (command == "filter") {
+        string text;
+        for (size_t i = 1; i < args.size(); i++) text += (i > 1 ? " " : "") + args[i];
+        FilterExpr filter;
+        string error;
+        if (args.size() < 2) {
+            cerr << "\nUsage: filter <expression>" << endl;
+            return false;
+        }
+        if (!parseFilter(text, filter, error)) {
+            cerr << "\nError: " << error << endl;
+            return false;
+        }
+        cout << "\nBooks matching " << text << ":" << endl;
+        int cursor = 0;
+        while (backend.printFilterPage(filter, text, cursor, 1000)) {
+        }
+        if (cursor == 0) cout << "None." << endl;
+        return true;
+    }
+
+    if (command == "author") {
+        ListFilter filter = ListFilter::All;
+        string author;
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i] == "--available") filter = ListFilter::Available;
+            else author += (author.empty() ? "" : " ") + args[i];
+        }
+        if (authorKey(author).empty()) {
+            cerr << "\nUsage: author <name> [--available]" << endl;
+            return false;
+        }
+        cout << "\n" << (filter == ListFilter::Available ? "Available books" : "Books") << " by " << author << ":" << endl;
+        int cursor = 0;
+        while (backend.printAuthorPage(author, filter, cursor, 1000)) {
+        }
+        return true;
+    }
+
+    if (command == "suggest") {
+        string prefix;
+        for (size_t i = 1; i < args.size(); i++) prefix += (i > 1 ? " " : "") + args[i];
+        if (normalizeKey(prefix).empty()) {
+            cerr << "\nUsage: suggest <prefix>" << endl;
+            return false;
+        }
+        cout << "\nTitles and authors starting with \"" << prefix << "\":" << endl;
+        if (backend.printSuggestions(prefix, DEFAULT_SUGGESTIONS) == 0) cout << "Nothing matches." << endl;
+        return true;
+    }
+
+    if (command == "checkout" || command == "checkin" || command == "delete") {
+        if (args.size() < 2) {
+            cerr << "\nUsage: " << command << " <id>..." << endl;
+            return false;
+        }
+        vector<int> ids;
+        for (size_t i = 1; i < args.size(); i++) {
+            int id = 0;
+            if (!parseInt(args[i], id)) {
+                cerr << "\nError: \"" << args[i] << "\" is not a book ID." << endl;
+                return false;
+            }
+            ids.push_back(id);
+        }
+        removeDuplicateIds(ids);
+
+        // Check-outs and check-ins of several books are one all-or-nothing batch.
+        if (command != "delete") {
+            if (ids.size() == 1) return backend.updateBookStatus(ids[0], command == "checkout");
+            return backend.updateBooksStatus(ids, command == "checkout");
+        }
+        bool ok = true;
+        for (int id : ids) ok = backend.deleteBookById(id) && ok;
+        return ok;
+    }
+
+    cerr << "\nUnknown command \"" << command << "\".\n" << COMMAND_USAGE << endl;
+    return false;
+}
+
+// Runs every command in a script file; blank lines and lines starting with #
+// are skipped. Keeps going after a failed command and reports the count at the end.
+bool runScript(LibraryBackend& backend, const string& scriptName) {
+    ifstream script(scriptName);
+    if (!script) {
+        cerr << "\nError: Could not open " << scriptName << "." << endl;
+        return false;
+    }
+
+    size_t run = 0, failed = 0, lineNumber = 0;
+    string line;
+    while (getline(script, line)) {
+        lineNumber++;
+        vector<string> args = splitCommandLine(line);
+        if (args.empty() || args[0][0] == '#') continue;
+        run++;
+        if (args[0] == "--script" || !runCommand(backend, args)) {
+            cerr << scriptName << ":" << lineNumber << ": command failed." << endl;
+            failed++;
+        }
+    }
+
+    cout << "\nScript finished: " << run << " commands, " << failed << " failed." << endl;
+    return failed == 0;
+}
+
+// Entry point for "Library <command> ...". Goes through the catalog server when
+// one is running. Read-only commands otherwise work on the file under a shared
+// lock, like the menu, so any number of them run side by side. Commands that
+// change the catalog, and scripts, lock the file once, load it into memory, run
+// against that copy, and save it once at the end.
+int runCommandLine(const string& filename, const vector<string>& args) {
+    if (args[0] == "--script" && args.size() != 2) {
+        cerr << "\nUsage: Library --script <file>" << endl;
+        return 1;
+    }
+    auto run = [&](LibraryBackend& backend) {
+        return args[0] == "--script" ? runScript(backend, args[1]) : runCommand(backend, args);
+    };
+
+#ifndef _WIN32
+    int serverFd = connectToServer(DEFAULT_SOCKET);
+    if (serverFd >= 0) {
+        RemoteBackend backend(serverFd);
+        return run(backend) ? 0 : 1;
+    }
+#endif
+
+    if (isReadOnlyCommand(args[0])) {
+        if (fileIsEmpty(filename)) seedLibrary(filename);
+        FileBackend backend(filename);
+        return run(backend) ? 0 : 1;
+    }
+
+    seedLibrary(filename);
+    FileLock lock(filename, FileLock::Exclusive);
+    Catalog catalog(filename);
+    LoadReport report = catalog.loadWhileLocked();
+    if (report.rejected() > 0) printLoadReport(report);
+
+    CatalogBackend backend(catalog);
+    bool ok = run(backend);
+    if (!catalog.persistWhileLocked()) {
+        cerr << "\nError: Could not save " << filename << "." << endl;
+        return 1;
+    }
+    return ok ? 0 : 1;
+}
+
+/* ------------------------
+ * Main Menu
+ * ------------------------
+ */
+int main(int argc, char* argv[]) {
+    const string filename = "library.csv";
+    int choice;
+
+    if (argc >= 2 && string(argv[1]) == "serve") {
+#ifdef _WIN32
+        cerr << "\nError: Server mode is not supported on this platform." << endl;
+        return 1;
+#else
+        ServerOptions options;
+        for (int i = 2; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--http" && i + 1 < argc && parseInt(argv[i + 1], options.httpPort)) i++;
+            else if (arg == "--background-save" && i + 1 < argc
+                && parseInt(argv[i + 1], options.backgroundSaveMs) && options.backgroundSaveMs > 0) i++;
+            else if (arg.rfind("--", 0) != 0) options.socketPath = arg;
+            else {
+                cerr << "\nUsage: Library serve [socket] [--http <port>] [--background-save <ms>]" << endl;
+                return 1;
+            }
+        }
+        seedLibrary(filename);
+        return runServer(filename, options);
+#endif
+    }
+
+    if (argc >= 2 && string(argv[1]) == "check") {
+        string rejectsFile;
+        if (argc == 4 && string(argv[2]) == "--rejects") rejectsFile = argv[3];
+        else if (argc != 2) {
+            cerr << "\nUsage: Library check [--rejects <file>]" << endl;
+            return 1;
+        }
+        return checkCatalogFile(filename, rejectsFile) ? 0 : 1;
+    }
+
+    if (argc >= 2 && string(argv[1]) == "standby") {
+#ifdef _WIN32
+        cerr << "\nError: Standby mode is not supported on this platform." << endl;
+        return 1;
+#else
+        if (argc > 3) {
+            cerr << "\nUsage: Library standby [copy.csv]" << endl;
+            return 1;
+        }
+        seedLibrary(filename);
+        return runStandby(filename, argc == 3 ? argv[2] : DEFAULT_STANDBY_FILE);
+#endif
+    }
+
+    if (argc >= 2) {
+        vector<string> args(argv + 1, argv + argc);
+        if (!isCommand(args[0])) {
+            cerr << "\n" << COMMAND_USAGE << endl;
+            return 1;
+        }
+        return runCommandLine(filename, args);
+    }
+
+    // Use the catalog server if one is running, otherwise work on the file directly.
+    unique_ptr<LibraryBackend> backend;
+#ifndef _WIN32
+    int serverFd = connectToServer(DEFAULT_SOCKET);
+    if (serverFd >= 0) {
+        backend = make_unique<RemoteBackend>(serverFd);
+        cout << "Connected to the catalog server on " << DEFAULT_SOCKET << "." << endl;
+    }
+#endif
+    if (!backend) {
+        // Seed initial library if empty
+        seedLibrary(filename);
+        backend = make_unique<FileBackend>(filename);
+    }
+
+    cout << "Welcome to the Library System!";
+
+    while (true) {
+        cout << "\n\n------------------------------" << endl;
+        cout << "What would you like to do?" << endl;
+        cout << "1. Add Book" << endl;
+        cout << "2. List Books" << endl;
+        cout << "3. Check Out Book" << endl;
+        cout << "4. Check In Book" << endl;
+        cout << "5. Delete Book" << endl;
+        cout << "6. Exit" << endl;
+        cout << "7. Search Books" << endl;
+        cout << "8. Books by Author" << endl;
         cout << "\nChoice: ";
         
 
         if (!(cin >> choice)) {
             cin.clear();
             cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            cout << "\nInvalid input. Please enter a number between 1 and 6." << endl;
+            cout << "\nInvalid input. Please enter a number between 1 and 8." << endl;
             continue;
         }
 
@@ -342,41 +6432,61 @@ int main() {
             cout << "Enter author: ";
             getline(cin, author);
 
-            int id = getNextId(filename);
-            Book newBook(id, title, author);
-            saveBook(filename, newBook);
+            int id = backend->addBook(title, author);
+            if (id < 0) continue;
             cout << "\nAdded \"" << title << "\" by " << author << " with ID " << id << "." << endl;
         }
         else if (choice == 2) {
-            listBooks(filename);
-        }
-        else if (choice == 3) {
-            listBooks(filename);
-            int id;
-            cout << "\nEnter the ID of the book to check out: ";
-            cin >> id;
-            updateBookStatus(filename, id, true);
+            browseBooks(*backend);
         }
-        else if (choice == 4) {
-            listBooks(filename);
-            int id;
-            cout << "\nEnter the ID of the book to check in: ";
-            cin >> id;
-            updateBookStatus(filename, id, false);
+        else if (choice == 3 || choice == 4) {
+            browseBooks(*backend);
+            bool checkOut = (choice == 3);
+            cout << "\nEnter the ID(s) of the book(s) to " << (checkOut ? "check out" : "check in")
+                << ", separated by spaces: ";
+            string line;
+            getline(cin >> ws, line);
+            vector<int> ids;
+            if (!parseIdList(line, ids)) {
+                cout << "\nInvalid input. Please enter one or more book IDs." << endl;
+                continue;
+            }
+            removeDuplicateIds(ids);
+            if (ids.size() == 1) backend->updateBookStatus(ids[0], checkOut);
+            else backend->updateBooksStatus(ids, checkOut);
         }
         else if (choice == 5) {
-            listBooks(filename);
+            browseBooks(*backend);
             int id;
             cout << "\nEnter the ID of the book to delete: ";
             cin >> id;
-            deleteBookById(filename, id);
+            backend->deleteBookById(id);
         }
         else if (choice == 6) {
+            if (lockStats().contended > 0) printLockStats();
             cout << "\nExiting program. Goodbye!" << endl;
             break;
         }
+        else if (choice == 7) {
+            string query;
+            cout << "\nSearch titles and authors (use OR between alternatives): ";
+            getline(cin >> ws, query);
+            if (parseSearchQuery(query).empty()) {
+                cout << "\nPlease enter at least one word to search for." << endl;
+                continue;
+            }
+            searchBooks(*backend, query);
+        }
+        else if (choice == 8) {
+            string author, answer;
+            cout << "\nAuthor: ";
+            getline(cin >> ws, author);
+            cout << "Only books on the shelf? (y/n): ";
+            getline(cin, answer);
+            browseAuthor(*backend, author, answer == "y" || answer == "Y" ? ListFilter::Available : ListFilter::All);
+        }
         else {
-            cout << "\nInvalid choice. Please enter a number between 1 and 6." << endl;
+            cout << "\nInvalid choice. Please enter a number between 1 and 8." << endl;
         }
     }
 
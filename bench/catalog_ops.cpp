@@ -0,0 +1,78 @@
+// Compares the sharded Catalog with a single mutex around a std::map under a
+// mix of 10% add+delete and 90% check-out/check-in on 10k books. Titles are
+// distinct and authors have ten books each, as in a real catalog:
+//     sh bench/catalog_ops.sh [operations] [revision to compare]
+// LIBRARY_SOURCE names the Library.cpp to build against, so the same harness
+// measures any revision that has Catalog.
+#define main library_main
+#include LIBRARY_SOURCE
+#undef main
+
+// The catalog as it was before sharding: one lock for everything.
+struct GlobalCatalog {
+    mutex m;
+    map<int, Book> books;
+    int nextId = 1;
+
+    int addBook(const string& title, const string& author) {
+        lock_guard<mutex> guard(m);
+        int id = nextId++;
+        books.emplace(id, Book(id, title, author, false));
+        return id;
+    }
+
+    void updateBookStatus(int id, bool checkOut) {
+        lock_guard<mutex> guard(m);
+        auto it = books.find(id);
+        if (it == books.end()) return;
+        if (checkOut) it->second.checkOut();
+        else it->second.checkIn();
+    }
+
+    void deleteBookById(int id) {
+        lock_guard<mutex> guard(m);
+        books.erase(id);
+    }
+};
+
+const int SEEDED = 10000;
+
+// Runs the operations split over the given number of threads and returns
+// millions of operations per second.
+template <class C>
+double measure(C& catalog, int threads, int operations) {
+    for (int i = 0; i < SEEDED; i++) catalog.addBook("Some Book Title " + to_string(i), "Author Name " + to_string(i % 1000));
+    auto started = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&catalog, t, threads, operations] {
+            unsigned x = static_cast<unsigned>(t) * 7919u + 1u;
+            string title = "New Title " + to_string(t), author = "New Author " + to_string(t);
+            for (int i = 0; i < operations / threads; i++) {
+                x = x * 1103515245u + 12345u;
+                int id = static_cast<int>(x % SEEDED) + 1;
+                if (i % 10 == 0) catalog.deleteBookById(catalog.addBook(title, author));
+                else catalog.updateBookStatus(id, i % 2 == 1);
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    return operations / chrono::duration<double>(chrono::steady_clock::now() - started).count() / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        cerr << "Usage: catalog_ops <operations> <catalog file that is never written>" << endl;
+        return 1;
+    }
+    int operations = atoi(argv[1]);
+    printf("threads  sharded      global mutex (std::map)\n");
+    for (int threads : { 1, 4, 16, 64 }) {
+        Catalog sharded(argv[2]);
+        GlobalCatalog global;
+        double a = measure(sharded, threads, operations);
+        double b = measure(global, threads, operations);
+        printf("%4d    %5.1f M/s    %5.1f M/s\n", threads, a, b);
+    }
+    return 0;
+}
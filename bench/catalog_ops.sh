@@ -0,0 +1,27 @@
+#!/bin/sh
+# Measures Catalog operations per second against a single global mutex at
+# 1, 4, 16 and 64 threads. Given a revision, builds that revision's
+# Library.cpp too and measures both.
+#
+#     sh bench/catalog_ops.sh [operations] [revision]
+#     sh bench/catalog_ops.sh 200000 HEAD~1
+set -eu
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+CXX=${CXX:-g++}
+OPERATIONS=${1:-200000}
+REVISION=${2:-}
+
+run() {
+    $CXX -std=c++17 -O2 -pthread -DLIBRARY_SOURCE="\"$2\"" -o "$WORK/catalog_ops" "$ROOT/bench/catalog_ops.cpp"
+    echo "$1:"
+    "$WORK/catalog_ops" "$OPERATIONS" "$WORK/unused.csv"
+}
+
+if [ -n "$REVISION" ]; then
+    git -C "$ROOT" show "$REVISION:Library.cpp" > "$WORK/Library.cpp"
+    run "$REVISION" "$WORK/Library.cpp"
+fi
+run "working tree" "$ROOT/Library.cpp"
@@ -0,0 +1,101 @@
+// Load test for the HTTP endpoint of "Library serve --http <port>". Each
+// connection is kept alive and sends one request at a time for the given
+// number of seconds; the result is requests per second over all connections.
+//     http_load <port> <connections> <seconds> list|checkout
+// "list" asks for GET /books?limit=10. "checkout" has every connection check
+// its own book out and back in with POST /books/<id>/checkout and /checkin,
+// so every request changes the catalog and none of them is refused.
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+atomic<long> completed{ 0 };
+atomic<long> failed{ 0 };
+atomic<bool> stopping{ false };
+
+// Reads one response, returning its status code, or 0 if the connection broke.
+int readResponse(int fd, string& buffer) {
+    char chunk[65536];
+    while (true) {
+        size_t headerEnd = buffer.find("\r\n\r\n");
+        if (headerEnd != string::npos) {
+            size_t length = 0;
+            size_t field = buffer.find("Content-Length: ");
+            if (field != string::npos && field < headerEnd) length = strtoul(buffer.c_str() + field + 16, nullptr, 10);
+            if (buffer.size() >= headerEnd + 4 + length) {
+                int status = atoi(buffer.c_str() + 9);
+                buffer.erase(0, headerEnd + 4 + length);
+                return status;
+            }
+        }
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return 0;
+        buffer.append(chunk, static_cast<size_t>(n));
+    }
+}
+
+void runConnection(int port, int connection, bool checkout) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        perror("connect");
+        exit(1);
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    string list = "GET /books?limit=10 HTTP/1.1\r\nHost: library\r\n\r\n";
+    string book = "/books/" + to_string(connection + 1);
+    string out = "POST " + book + "/checkout HTTP/1.1\r\nHost: library\r\nContent-Length: 0\r\n\r\n";
+    string in = "POST " + book + "/checkin HTTP/1.1\r\nHost: library\r\nContent-Length: 0\r\n\r\n";
+    string buffer;
+    for (long i = 0; !stopping.load(memory_order_relaxed); i++) {
+        const string& request = !checkout ? list : (i % 2 == 0 ? out : in);
+        if (send(fd, request.data(), request.size(), 0) < 0) break;
+        int status = readResponse(fd, buffer);
+        if (status == 0) break;
+        if (status >= 300) failed++;
+        completed++;
+    }
+    close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 5 || (strcmp(argv[4], "list") != 0 && strcmp(argv[4], "checkout") != 0)) {
+        fprintf(stderr, "Usage: http_load <port> <connections> <seconds> list|checkout\n");
+        return 1;
+    }
+    int port = atoi(argv[1]);
+    int connections = atoi(argv[2]);
+    double seconds = atof(argv[3]);
+    bool checkout = strcmp(argv[4], "checkout") == 0;
+
+    vector<thread> threads;
+    auto started = chrono::steady_clock::now();
+    for (int i = 0; i < connections; i++) threads.emplace_back(runConnection, port, i, checkout);
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    stopping = true;
+    for (auto& t : threads) t.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    printf("%d connections, %s: %.0f req/s", connections, checkout ? "POST checkout/checkin" : "GET /books?limit=10",
+        completed.load() / elapsed);
+    if (failed > 0) printf(" (%ld responses were errors)", failed.load());
+    printf("\n");
+    return failed > 0 ? 1 : 0;
+}
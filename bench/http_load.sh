@@ -0,0 +1,27 @@
+#!/bin/sh
+# Starts "Library serve --http" on the seeded catalog and measures requests per
+# second for paging and for check-out/check-in over keep-alive connections.
+#
+#     sh bench/http_load.sh [connections] [seconds] [port]
+set -eu
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+SERVER=
+trap 'kill $SERVER 2>/dev/null || true; rm -rf "$WORK"' EXIT
+CXX=${CXX:-g++}
+CONNECTIONS=${1:-8}
+SECONDS_EACH=${2:-3}
+PORT=${3:-18036}
+
+$CXX -std=c++17 -O2 -pthread -o "$WORK/Library" "$ROOT/Library.cpp"
+$CXX -std=c++17 -O2 -pthread -o "$WORK/http_load" "$ROOT/bench/http_load.cpp"
+cd "$WORK"
+
+./Library serve --http "$PORT" > server.log 2>&1 &
+SERVER=$!
+i=0
+while [ ! -S library.sock ] && [ $i -lt 100 ]; do sleep 0.05; i=$((i + 1)); done
+
+./http_load "$PORT" "$CONNECTIONS" "$SECONDS_EACH" list
+./http_load "$PORT" "$CONNECTIONS" "$SECONDS_EACH" checkout
@@ -0,0 +1,23 @@
+// Times listBooks() printing a whole catalog. Run with stdout on /dev/null so
+// the figure is parsing, formatting and writing, not the terminal:
+//     sh bench/list_output.sh [rows] [revision to compare]
+// LIBRARY_SOURCE names the Library.cpp to build against, so the same harness
+// measures any revision that has listBooks().
+#define main library_main
+#include LIBRARY_SOURCE
+#undef main
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        cerr << "Usage: list_output <catalog.csv> <runs>" << endl;
+        return 1;
+    }
+    double best = numeric_limits<double>::max();
+    for (int run = 0; run < atoi(argv[2]); run++) {
+        auto started = chrono::steady_clock::now();
+        listBooks(argv[1]);
+        best = min(best, chrono::duration<double>(chrono::steady_clock::now() - started).count());
+    }
+    cerr << "listBooks: best of " << argv[2] << " runs " << best << " s" << endl;
+    return 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Lists a generated catalog to /dev/null and reports the best of three runs.
+# Given a revision, builds that revision's Library.cpp too and times both.
+#
+#     sh bench/list_output.sh [rows] [revision]
+#     sh bench/list_output.sh 1000000 HEAD~1
+set -eu
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+CXX=${CXX:-g++}
+ROWS=${1:-1000000}
+REVISION=${2:-}
+
+awk -v rows="$ROWS" 'BEGIN {
+    for (i = 1; i <= rows; i++)
+        printf "%d, Some Book Title Number %d, Author Name %d, %s\n", i, i, i % 1000, (i % 3 ? "No" : "Yes")
+}' > "$WORK/books.csv"
+
+run() {
+    $CXX -std=c++17 -O2 -pthread -DLIBRARY_SOURCE="\"$2\"" -o "$WORK/list_output" "$ROOT/bench/list_output.cpp"
+    printf '%s: ' "$1"
+    "$WORK/list_output" "$WORK/books.csv" 3 2>&1 > /dev/null
+}
+
+if [ -n "$REVISION" ]; then
+    git -C "$ROOT" show "$REVISION:Library.cpp" > "$WORK/Library.cpp"
+    run "$REVISION" "$WORK/Library.cpp"
+fi
+run "working tree" "$ROOT/Library.cpp"
@@ -0,0 +1,73 @@
+#!/bin/sh
+# Several terminals sharing one library.csv must not lose each other's
+# changes. Eight processes add books at the same time, half through the menu
+# (file mode) and half through command-line runs, while each also checks its
+# own book out and in. Afterwards every added book must be there exactly once
+# with its own ID, and every check-out and check-in must have succeeded.
+#
+#     sh tests/concurrent_terminals.sh [books per terminal]
+set -eu
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+CXX=${CXX:-g++}
+$CXX -std=c++17 -O2 -pthread -o "$WORK/Library" "$ROOT/Library.cpp"
+cd "$WORK"
+
+TERMINALS=8
+BOOKS=${1:-100}
+SEEDED=19
+
+./Library list > /dev/null
+
+terminal() {
+    p=$1
+    book=$((p + 1))
+    i=1
+    while [ $i -le "$BOOKS" ]; do
+        if [ $((p % 2)) -eq 0 ]; then
+            printf '1\nTitle %d-%d\nAuthor %d\n6\n' "$p" "$i" "$p" | ./Library > /dev/null
+        else
+            ./Library add "Title $p-$i" "Author $p" > /dev/null
+        fi
+        if [ $((i % 10)) -eq 0 ]; then
+            if [ $((i % 20)) -eq 10 ]; then ./Library checkout $book; else ./Library checkin $book; fi
+        fi
+        i=$((i + 1))
+    done > "out.$p" 2>&1
+}
+
+p=0
+while [ $p -lt $TERMINALS ]; do
+    terminal $p &
+    p=$((p + 1))
+done
+wait
+
+fail() {
+    echo "FAIL: $1" >&2
+    exit 1
+}
+
+rows=$(wc -l < library.csv)
+ids=$(cut -d, -f1 library.csv | sort -u | wc -l)
+expected=$((SEEDED + TERMINALS * BOOKS))
+[ "$rows" -eq "$expected" ] || fail "$rows rows, expected $expected"
+[ "$ids" -eq "$expected" ] || fail "$ids distinct IDs in $rows rows"
+
+p=0
+while [ $p -lt $TERMINALS ]; do
+    i=1
+    while [ $i -le "$BOOKS" ]; do
+        count=$(grep -c ", Title $p-$i, Author $p, " library.csv || true)
+        [ "$count" -eq 1 ] || fail "\"Title $p-$i\" appears $count times"
+        i=$((i + 1))
+    done
+    if grep -q "Error" "out.$p"; then fail "terminal $p: $(grep Error "out.$p" | head -1)"; fi
+    updates=$(grep -c "^Updated book with ID $((p + 1)) " "out.$p" || true)
+    [ "$updates" -eq $((BOOKS / 10)) ] || fail "terminal $p: $updates of $((BOOKS / 10)) status changes went through"
+    p=$((p + 1))
+done
+
+echo "ok - $TERMINALS terminals added $((TERMINALS * BOOKS)) books and changed $((TERMINALS * (BOOKS / 10))) statuses; nothing lost"
@@ -0,0 +1,73 @@
+#!/bin/sh
+# Rows the parser rejects must come back unchanged from every command that
+# rewrites library.csv: the menu (file mode), command-line runs, --script and
+# the server's background save. That includes rows with an ID of 0 or below,
+# which older files may contain, and a row repeating an earlier row's ID.
+#
+#     sh tests/rejected_rows.sh
+set -eu
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'kill $SERVER 2>/dev/null || true; rm -rf "$WORK"' EXIT
+SERVER=
+CXX=${CXX:-g++}
+$CXX -std=c++17 -O2 -pthread -o "$WORK/Library" "$ROOT/Library.cpp"
+cd "$WORK"
+
+BAD='2, Emma, Jane Austen, yes
+3abc, Bad Id, Someone, No
+0, Zero Id, Someone, No
+-7, Negative Id, Someone, Yes
+5, Too, Few Fields
+1, Dune Again, Someone, No'
+
+reset() {
+    rm -f library.csv*
+    printf '1, Dune, Frank Herbert, No\n%s\n4, Ulysses, James Joyce, No\n' "$BAD" > library.csv
+}
+
+# Every rejected row must still be in the file, and exactly once.
+check() {
+    echo "$BAD" | while IFS= read -r row; do
+        count=$(grep -cxF -e "$row" library.csv || true)
+        if [ "$count" != 1 ]; then
+            echo "FAIL: $1: \"$row\" appears $count times" >&2
+            cat library.csv >&2
+            exit 1
+        fi
+    done
+    grep -q "^$2\$" library.csv || { echo "FAIL: $1: expected row \"$2\"" >&2; cat library.csv >&2; exit 1; }
+    echo "ok - $1"
+}
+
+reset
+./Library checkout 1 > /dev/null 2>&1
+check "command-line checkout" "1, Dune, Frank Herbert, Yes"
+./Library delete 4 > /dev/null 2>&1
+check "command-line delete" "1, Dune, Frank Herbert, Yes"
+
+reset
+printf 'checkout 1\ncheckin 1\ncheckout 4\n' > batch.txt
+./Library --script batch.txt > /dev/null 2>&1
+check "--script" "4, Ulysses, James Joyce, Yes"
+
+reset
+printf '3\n1\n6\n' | ./Library > /dev/null 2>&1
+check "menu checkout" "1, Dune, Frank Herbert, Yes"
+printf '5\n4\n6\n' | ./Library > /dev/null 2>&1
+check "menu delete" "1, Dune, Frank Herbert, Yes"
+
+reset
+./Library serve --background-save 50 > server.log 2>&1 &
+SERVER=$!
+i=0
+while [ ! -S library.sock ] && [ $i -lt 100 ]; do sleep 0.05; i=$((i + 1)); done
+./Library checkout 4 > /dev/null 2>&1
+i=0
+while ! grep -q '^4, Ulysses, James Joyce, Yes$' library.csv && [ $i -lt 100 ]; do sleep 0.05; i=$((i + 1)); done
+check "background save" "4, Ulysses, James Joyce, Yes"
+kill $SERVER
+wait $SERVER 2>/dev/null || true
+SERVER=
+check "save on shutdown" "4, Ulysses, James Joyce, Yes"